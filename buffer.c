@@ -75,22 +75,86 @@ void buf_adjust(struct buffer *buf, size_t mod) {
 	mutex_unlock(buf->mutex);
 }
 
-// called with mutex locked to resize, does not retain contents, reverts to original size if fails
-void _buf_resize(struct buffer *buf, size_t size) {
-	free(buf->buf);
-	buf->buf = malloc(size);
-	if (!buf->buf) {
-		size    = buf->size;
-		buf->buf= malloc(size);
-		if (!buf->buf) {
-			size = 0;
+// called without the mutex held by the writer of a buffer, or while the reader can not consume, allocates and fills the
+// new allocation for _buf_resize_commit, taking the mutex only to read the pointers - the contents copied are left
+// unchanged as the writer only writes to free space and consumed space is not written over meanwhile - returns false
+// if the contents do not fit or the allocation fails
+bool buf_resize_prepare(struct buffer *buf, struct bufresize *r, size_t size, size_t align) {
+	size_t cont;
+
+	mutex_lock(buf->mutex);
+	r->old = buf->buf;
+	r->readp = buf->readp;
+	r->used = _buf_used(buf);
+	r->offset = (buf->readp - buf->buf) % align;
+	cont = min(r->used, _buf_cont_read(buf));
+	mutex_unlock(buf->mutex);
+
+	r->size = size;
+
+	if (r->offset + r->used >= size || !(r->buf = malloc(size))) {
+		return false;
+	}
+
+	memcpy(r->buf + r->offset, r->readp, cont);
+	memcpy(r->buf + r->offset + cont, r->old, r->used - cont);
+
+	return true;
+}
+
+// called with mutex locked to switch to a prepared allocation, copying what was written since it was filled and moving
+// the count positions ahead of readp in ptrs - fails if readp was moved back or the buffer flushed meanwhile or they no
+// longer fit, the caller frees r->buf once the mutex is released, the old allocation on success or the unused one
+bool _buf_resize_commit(struct buffer *buf, struct bufresize *r, u8_t **ptrs[], unsigned count) {
+	size_t consumed = buf->readp >= r->readp ? buf->readp - r->readp : buf->readp + buf->size - r->readp;
+	size_t used = _buf_used(buf);
+	size_t extent = used;
+	size_t written, cont;
+	u8_t *from;
+	unsigned i;
+
+	if (buf->buf != r->old || consumed > r->used || consumed + used < r->used) {
+		return false;
+	}
+
+	for (i = 0; i < count; ++i) {
+		u8_t *ptr = *ptrs[i];
+		if (ptr) {
+			extent = max(extent, (size_t)(ptr >= buf->readp ? ptr - buf->readp : ptr + buf->size - buf->readp));
 		}
 	}
-	buf->readp  = buf->buf;
-	buf->writep = buf->buf;
-	buf->wrap   = buf->buf + size;
-	buf->size   = size;
-	buf->base_size = size;
+
+	if (r->offset + consumed + extent >= r->size) {
+		return false;
+	}
+
+	// frames written since the contents were copied follow them
+	written = consumed + used - r->used;
+	from = r->readp + r->used;
+	if (from >= buf->wrap) {
+		from -= buf->size;
+	}
+	cont = min(written, (size_t)(buf->wrap - from));
+	memcpy(r->buf + r->offset + r->used, from, cont);
+	memcpy(r->buf + r->offset + r->used + cont, buf->buf, written - cont);
+
+	for (i = 0; i < count; ++i) {
+		u8_t *ptr = *ptrs[i];
+		if (ptr) {
+			*ptrs[i] = r->buf + r->offset + consumed + (ptr >= buf->readp ? ptr - buf->readp : ptr + buf->size - buf->readp);
+		}
+	}
+
+	buf->buf    = r->buf;
+	buf->readp  = r->buf + r->offset + consumed;
+	buf->writep = buf->readp + used;
+	buf->wrap   = r->buf + r->size;
+	buf->size   = r->size;
+	buf->base_size = r->size;
+
+	r->buf = r->old;
+
+	return true;
 }
 
 void buf_init(struct buffer *buf, size_t size) {
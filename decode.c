@@ -32,7 +32,17 @@ extern struct outputstate output;
 struct decodestate decode;
 struct codec *codecs[MAX_CODECS];
 static struct codec *codec;
+static const char *codec_opt;
 static bool running = true;
+static decode_state end_state = DECODE_RUNNING; // codec state held back until process stage frames are in outputbuf
+static u64_t decoded_frames;                    // frames decoded since the stream started, outputbuf mutex held
+static unsigned decoded_rate;
+static unsigned stream_secs, output_secs;       // buffer targets, 0 for a buffer of fixed size
+static size_t buffer_max;
+static u8_t last_format;                        // format of the last stream and its measured bitrate
+static u32_t last_bitrate;
+static size_t output_resize_size;               // set for a new stream, outputbuf is resized once the codec returns
+static bool crossfading;                        // a stream has set a crossfade, so the player is configured for them
 
 #define LOCK_S   mutex_lock(streambuf->mutex)
 #define UNLOCK_S mutex_unlock(streambuf->mutex)
@@ -41,19 +51,62 @@ static bool running = true;
 #define LOCK_D   mutex_lock(decode.mutex);
 #define UNLOCK_D mutex_unlock(decode.mutex);
 
+// called with decode mutex locked once the codec has finished
+static void decode_end(void) {
+	LOG_INFO("decode %s", decode.state == DECODE_COMPLETE ? "complete" : "error");
+
+	LOCK_O;
+	_output_direct_end();
+	if (output.fade_mode) _checkfade(false);
+	UNLOCK_O;
+
+	wake_controller();
+}
+
+// dlopen each codec library, run in the decode thread so it overlaps output device probing and server discovery
+static void register_codecs(const char *opt) {
+	int i;
+
+	// register codecs
+	// alc,wma,wmap,wmal,aac,spt,ogg,ogf,flc,aif,pcm,mp3
+	i = 0;
+	if (!opt || strstr(opt, "aac"))  codecs[i++] = register_faad();
+	if (!opt || strstr(opt, "ogg"))  codecs[i++] = register_vorbis();
+	if (!opt || strstr(opt, "flac")) codecs[i++] = register_flac();
+	if (!opt || strstr(opt, "pcm"))  codecs[i++] = register_pcm();
+
+	// try mad then mpg for mp3 unless command line option passed
+	if ( !opt || strstr(opt, "mp3") || strstr(opt, "mad"))                codecs[i] = register_mad();
+	if ((!opt || strstr(opt, "mp3") || strstr(opt, "mpg")) && !codecs[i]) codecs[i] = register_mpg();
+}
+
 static void *decode_thread() {
 
+	LOCK_D;
+	register_codecs(codec_opt);
+	decode.ready = true;
+	UNLOCK_D;
+
+	LOG_INFO("startup: codecs loaded at %u ms", startup_ms());
+
 	while (running) {
 		size_t bytes, space;
-		bool toend;
+		u64_t consumed;
+		bool toend, queued;
 		bool ran = false;
 
 		LOCK_S;
 		bytes = _buf_used(streambuf);
 		toend = (stream.state <= DISCONNECT);
+		consumed = stream.bytes - bytes;
 		UNLOCK_S;
 		LOCK_O;
 		space = _buf_space(outputbuf);
+		queued = (output.track_count == TRACK_STARTS);
+		// bitrate from stream bytes consumed for frames decoded, once there is 100ms to measure, for output to start on
+		if (decoded_frames > decoded_rate / 10 && consumed) {
+			output.bitrate = (u32_t)(consumed * decoded_rate / decoded_frames);
+		}
 		UNLOCK_O;
 
 		LOCK_D;
@@ -61,26 +114,55 @@ static void *decode_thread() {
 		if (decode.state == DECODE_RUNNING && codec) {
 		
 			LOG_SDEBUG("streambuf bytes: %u outputbuf space: %u", bytes, space);
-			
-			if (space > codec->min_space && (bytes > codec->min_read_bytes || toend)) {
+
+			if (decode.process && process_pending()) {
+
+				// don't call codec until all processed frames have been transferred to outputbuf
+				LOCK_O;
+				ran = _process_transfer();
+				UNLOCK_O;
+
+				if (ran && end_state != DECODE_RUNNING) {
+					decode.state = end_state;
+					end_state = DECODE_RUNNING;
+					decode_end();
+				}
+
+			} else if (space > codec->min_space && (bytes > codec->min_read_bytes || toend) &&
+					   !(decode.new_stream && queued)) {
 				
 				decode.state = codec->decode();
 
-				if (decode.state != DECODE_RUNNING) {
+				if (decode.process) {
+
+					process_samples();
 
-					LOG_INFO("decode %s", decode.state == DECODE_COMPLETE ? "complete" : "error");
+					if (decode.state != DECODE_RUNNING) {
+						process_drain();
+					}
 
 					LOCK_O;
-					if (output.fade_mode) _checkfade(false);
+					if (!_process_transfer() && decode.state != DECODE_RUNNING) {
+						end_state = decode.state;
+						decode.state = DECODE_RUNNING;
+					}
 					UNLOCK_O;
+				}
 
-					wake_controller();
+				if (decode.state != DECODE_RUNNING) {
+					decode_end();
 				}
 
 				ran = true;
 			}
 		}
 		
+		// resized with the decode mutex held, so no other thread writes to outputbuf while it is copied
+		if (output_resize_size) {
+			output_resize(output_resize_size);
+			output_resize_size = 0;
+		}
+
 		UNLOCK_D;
 
 		if (!ran) {
@@ -93,24 +175,18 @@ static void *decode_thread() {
 
 static thread_type thread;
 
-void decode_init(log_level level, const char *opt) {
-	int i;
-
+void decode_init(log_level level, const char *opt, unsigned s_secs, unsigned o_secs, unsigned max) {
 	loglevel = level;
 
 	LOG_INFO("init decode");
 
-	// register codecs
-	// alc,wma,wmap,wmal,aac,spt,ogg,ogf,flc,aif,pcm,mp3
-	i = 0;
-	if (!opt || strstr(opt, "aac"))  codecs[i++] = register_faad();
-	if (!opt || strstr(opt, "ogg"))  codecs[i++] = register_vorbis();
-	if (!opt || strstr(opt, "flac")) codecs[i++] = register_flac();
-	if (!opt || strstr(opt, "pcm"))  codecs[i++] = register_pcm();
-
-	// try mad then mpg for mp3 unless command line option passed
-	if ( !opt || strstr(opt, "mp3") || strstr(opt, "mad"))                codecs[i] = register_mad();
-	if ((!opt || strstr(opt, "mp3") || strstr(opt, "mpg")) && !codecs[i]) codecs[i] = register_mpg();
+	codec_opt = opt;
+	stream_secs = s_secs;
+	output_secs = o_secs;
+	buffer_max = max;
+	decode.ready = false;
+	decode.new_stream = true;
+	decode.state = DECODE_STOPPED;
 
 	mutex_create(decode.mutex);
 
@@ -124,9 +200,6 @@ void decode_init(log_level level, const char *opt) {
 #if WIN
 	thread = CreateThread(NULL, DECODE_THREAD_STACK_SIZE, (LPTHREAD_START_ROUTINE)&decode_thread, NULL, 0, NULL);
 #endif
-
-	decode.new_stream = true;
-	decode.state = DECODE_STOPPED;
 }
 
 void decode_close(void) {
@@ -144,6 +217,106 @@ void decode_close(void) {
 	mutex_destroy(decode.mutex);
 }
 
+// a buffer is only resized for a change of more than an eighth, so tracks of similar bitrate do not reallocate it
+static bool resize_due(size_t size, size_t target) {
+	return target > size + size / 8 || target < size - size / 8;
+}
+
+// size of a buffer for its target, within its minimum and what the cap leaves from the other buffer
+static size_t buffer_size(u64_t target, size_t min, size_t other) {
+	size_t max = buffer_max > other + min ? buffer_max - other : min;
+	return (size_t)(target < min ? min : target > max ? max : target);
+}
+
+// what the cap on buffer memory leaves beside streambuf and outputbuf, for crossbuf, called without mutexes held
+size_t decode_buffer_room(void) {
+	size_t used;
+
+	LOCK_S;
+	used = streambuf->size;
+	UNLOCK_S;
+	LOCK_O;
+	used += outputbuf->size;
+	UNLOCK_O;
+
+	return buffer_max > used ? buffer_max - used : 0;
+}
+
+// stream bytes per second of a format until a bitrate has been measured for it, lossless formats at cd quality
+static u32_t nominal_bitrate(u8_t format) {
+	switch (format) {
+	case 'p': return 44100 * 2 * 2;
+	case 'f': return 44100 * 2 * 2 * 6 / 10;
+	default:  return 320 * 1000 / 8;
+	}
+}
+
+// called with outputbuf mutex locked by codecs at the start of each stream, returns the sample rate of output frames
+unsigned _decode_newstream(unsigned sample_rate) {
+	unsigned out_rate = sample_rate;
+	unsigned frame_bytes = BYTES_PER_FRAME;
+	bool resample = false;
+
+#if RESAMPLE
+	// the resampler may run at the track rate to correct dac clock drift
+	out_rate = resample_newstream(sample_rate, output.max_sample_rate);
+	resample = resample_active();
+#endif
+
+	// store frames in device format if the output thread can write them without conversion, fades need 32 bit frames -
+	// a track crossfades from the one before so once crossfades are configured every track is kept in 32 bit frames,
+	// the server does not set one for a stream with nothing playing before it
+	if (output.fade_mode == FADE_CROSSFADE && !crossfading) {
+		crossfading = true;
+		if (output.native_frame_bytes) {
+			LOG_INFO("crossfade configured - frames no longer stored in device format");
+		}
+	}
+	if (output.native_frame_bytes && output.fade_mode == FADE_NONE && !crossfading) {
+		frame_bytes = output.native_frame_bytes;
+	}
+
+	output.tail_frame_bytes = output.next_frame_bytes;
+	output.next_frame_bytes = frame_bytes;
+
+	// outputbuf is sized for the new rate once the codec has returned and released the mutex, streambuf is only resized
+	// in codec_open with the decode mutex held, which this thread also holds
+	if (output_secs) {
+		size_t size = buffer_size((u64_t)output_secs * out_rate * frame_bytes, OUTPUTBUF_MIN, streambuf->size + output.cross_size);
+		output_resize_size = resize_due(outputbuf->size, size) ? size : 0;
+	}
+
+	decoded_frames = 0;
+	decoded_rate = sample_rate;
+	output.bitrate = 0;
+
+	decode.process = (resample || frame_bytes != BYTES_PER_FRAME);
+	if (decode.process) {
+		_process_newstream(resample, frame_bytes);
+	}
+
+	return out_rate;
+}
+
+// called with outputbuf mutex locked by codecs in place of advancing writep
+void _decode_inc_writep(size_t bytes) {
+	decoded_frames += bytes / BYTES_PER_FRAME;
+	if (decode.process) {
+		_process_append(bytes);
+	} else {
+		_buf_inc_writep(outputbuf, bytes);
+	}
+}
+
+// discard any decoded frames not yet in outputbuf
+void decode_flush(void) {
+	LOCK_D;
+	process_flush();
+	decode.process = false;
+	end_state = DECODE_RUNNING;
+	UNLOCK_D;
+}
+
 void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels, u8_t endianness) {
 	int i;
 
@@ -154,6 +327,46 @@ void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels,
 	decode.new_stream = true;
 	decode.state = DECODE_STOPPED;
 
+	// size streambuf from the bitrate measured for the last stream if of the same format, it holds no more of the last
+	// stream once the next is opened but any remaining is retained
+	if (stream_secs) {
+		u32_t bitrate;
+		size_t size;
+
+		LOCK_O;
+		if (output.bitrate && codec) {
+			last_format = codec->id;
+			last_bitrate = output.bitrate;
+		}
+		size = outputbuf->size + output.cross_size;
+		UNLOCK_O;
+
+		bitrate = format == last_format && last_bitrate ? last_bitrate : nominal_bitrate(format);
+		size = buffer_size((u64_t)stream_secs * bitrate, STREAMBUF_MIN, size);
+
+		// allocated and filled without the mutex so the stream thread is not held up, the decode mutex keeps the codec
+		// from consuming meanwhile and the stream thread only writes to free space
+		LOCK_S;
+		if (resize_due(streambuf->size, size)) {
+			struct bufresize r;
+			bool ok;
+			UNLOCK_S;
+			if ((ok = buf_resize_prepare(streambuf, &r, size, 1))) {
+				LOCK_S;
+				ok = _buf_resize_commit(streambuf, &r, NULL, 0);
+				UNLOCK_S;
+				free(r.buf);
+			}
+			if (ok) {
+				LOG_INFO("streambuf resized: %u for bitrate: %u", (unsigned)size, bitrate);
+			} else {
+				LOG_WARN("unable to resize streambuf: %u", (unsigned)size);
+			}
+		} else {
+			UNLOCK_S;
+		}
+	}
+
 	// find the required codec
 	for (i = 0; i < MAX_CODECS; ++i) {
 
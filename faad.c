@@ -334,8 +334,12 @@ static decode_state faad_decode(void) {
 
 			LOCK_O;
 			LOG_INFO("setting track_start");
-			output.next_sample_rate = samplerate;
-			output.track_start = outputbuf->writep;
+			output.next_sample_rate = _decode_newstream(samplerate);
+			if (!_output_track_start()) {
+				UNLOCK_O;
+				UNLOCK_S;
+				return DECODE_ERROR;
+			}
 			if (output.fade_mode) _checkfade(true);
 			decode.new_stream = false;
 			UNLOCK_O;
@@ -470,7 +474,7 @@ static decode_state faad_decode(void) {
 		}
 
 		frames -= f;
-		_buf_inc_writep(outputbuf, f * BYTES_PER_FRAME);
+		_decode_inc_writep(f * BYTES_PER_FRAME);
 	}
 
 	UNLOCK_O;
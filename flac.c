@@ -93,8 +93,11 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 
 	if (decode.new_stream) {
 		LOG_INFO("setting track_start");
-		output.next_sample_rate = frame->header.sample_rate;
-		output.track_start = outputbuf->writep;
+		output.next_sample_rate = _decode_newstream(frame->header.sample_rate);
+		if (!_output_track_start()) {
+			UNLOCK_O;
+			return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+		}
 		if (output.fade_mode) _checkfade(true);
 		decode.new_stream = false;
 	}
@@ -124,7 +127,7 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 		}
 
 		frames -= f;
-		_buf_inc_writep(outputbuf, f * BYTES_PER_FRAME);
+		_decode_inc_writep(f * BYTES_PER_FRAME);
 	}
 
 	UNLOCK_O;
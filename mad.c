@@ -187,8 +187,11 @@ static decode_state mad_decode(void) {
 		
 		if (decode.new_stream) {
 			LOG_INFO("setting track_start");
-			output.next_sample_rate = m->synth.pcm.samplerate;
-			output.track_start = outputbuf->writep;
+			output.next_sample_rate = _decode_newstream(m->synth.pcm.samplerate);
+			if (!_output_track_start()) {
+				UNLOCK_O;
+				return DECODE_ERROR;
+			}
 			if (output.fade_mode) _checkfade(true);
 			decode.new_stream = false;
 		}
@@ -230,7 +233,7 @@ static decode_state mad_decode(void) {
 				*optr++ = scale(*iptrr++);
 			}
 			frames -= f;
-			_buf_inc_writep(outputbuf, f * BYTES_PER_FRAME);
+			_decode_inc_writep(f * BYTES_PER_FRAME);
 		}
 
 		UNLOCK_O;
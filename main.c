@@ -31,12 +31,16 @@ static void usage(const char *argv0) {
 		   "  -o <output device>\tSpecify output device, default \"default\"\n"
 		   "  -l \t\t\tList output devices\n"
 #if ALSA
-		   "  -a <b>:<c>:<f>:<m>\tSpecify ALSA params to open output device, b = buffer time in ms, c = period count, f sample format (16|24|24_3|32), m = use mmap (0|1)\n"
+		   "  -a <b>:<c>:<f>:<m>:<r>:<n>\tSpecify ALSA params to open output device, b = buffer time in ms, c = period count, f sample format (16|24|24_3|32), m = use mmap (0|1), r = rewind device buffer on volume change (0|1), n = buffer frames in device format when 16 or 24_3 (0|1), 2 = also decode direct into mmap area\n"
+		   "  -V <control>\t\tUse ALSA mixer control for volume, digital gain only beyond its range, control = name or auto\n"
+		   "  -C <timeout>\t\tClose output device when idle after timeout seconds, so it can suspend, default is to keep it open while player is on\n"
+		   "  -X <max>\t\tStep ALSA buffer time up to max ms on repeated xruns, and back down to the -a buffer time when clean\n"
+		   "  -T <margin>\t\tTimer scheduled output, wake when the device buffer falls to margin ms rather than each period, use with a large -a buffer time\n"
 #endif
 #if PORTAUDIO
 		   "  -a <latency>\t\tSpecify output target latency in ms\n"
 #endif
-		   "  -b <stream>:<output>\tSpecify internal Stream and Output buffer sizes in Kbytes\n"
+		   "  -b <stream>:<output>:<max>\tSpecify internal Stream and Output buffer sizes, in seconds of audio with a trailing s (default %us:%us) resized between tracks for the bitrate and sample rate, or fixed in Kbytes, max = cap in Kbytes on both together (default %u)\n"
 		   "  -c <codec1>,<codec2>\tRestrict codecs those specified, otherwise loads all available codecs; known codecs: flac,pcm,mp3,ogg,aac (mad,mpg for specific mp3 codec)\n"
 		   "  -d <log>=<level>\tSet logging level, logs: all|slimproto|stream|decode|output, level: info|debug|sdebug\n"
 		   "  -f <logfile>\t\tWrite debug to logfile\n"
@@ -46,12 +50,19 @@ static void usage(const char *argv0) {
 		   "  -p <priority>\t\tSet real time priority of output thread (1-99)\n"
 #endif
 		   "  -r <rate>\t\tMax sample rate for output device, enables output device to be off when squeezelite is started\n"
+#if LINUX || OSX
+		   "  -s <file>\t\tFile the last server connected to is cached in, tried at start while discovering, default $HOME/.squeezelite.server, not cached if HOME is unset\n"
+#endif
+#if RESAMPLE
+		   "  -R <q>:<rate>:<f>\tResample all tracks to rate (default max sample rate), q = quality (v|h|m|l|q), f = nearest rate in 44.1k/48k family of track (0|1)\n"
+		   "  -D \t\t\tCorrect output device clock drift against this host's clock by adaptive resampling, not against the server or other players\n"
+#endif
 #if LINUX
 		   "  -z \t\t\tDaemonize\n"
 #endif
 		   "  -t \t\t\tLicense terms\n"
 		   "\n",
-		   argv0);
+		   argv0, STREAMBUF_SECS, OUTPUTBUF_SECS, BUFFER_MAX / 1024);
 }
 
 static void license(void) {
@@ -98,9 +109,13 @@ int main(int argc, char **argv) {
 	char *codecs = NULL;
 	char *name = NULL;
 	char *logfile = NULL;
+	char *server_cache = NULL;
 	u8_t mac[6];
 	unsigned stream_buf_size = STREAMBUF_SIZE;
 	unsigned output_buf_size =  OUTPUTBUF_SIZE;
+	unsigned stream_buf_secs = STREAMBUF_SECS;
+	unsigned output_buf_secs = OUTPUTBUF_SECS;
+	unsigned buffer_max = BUFFER_MAX;
 	unsigned max_rate = 0;
 #if LINUX
 	bool daemonize = false;
@@ -110,11 +125,24 @@ int main(int argc, char **argv) {
 	unsigned alsa_period_count = ALSA_PERIOD_COUNT;
 	char *alsa_sample_fmt = NULL;
 	bool alsa_mmap = true;
+	bool alsa_rewind = false;
+	unsigned alsa_native = 0;
+	char *alsa_mixer = NULL;
+	unsigned alsa_tsched = 0;
+	unsigned alsa_tune_max = 0;
+	unsigned alsa_idle = 0;
 	unsigned rt_priority = OUTPUT_RT_PRIORITY;
 #endif
 #if PORTAUDIO
 	unsigned pa_latency = 0;
 #endif
+#if RESAMPLE
+	bool resample = false;
+	char *resample_quality = NULL;
+	unsigned resample_rate = 0;
+	bool resample_family = false;
+	bool resample_drift = false;
+#endif
 	
 	log_level log_output = lWARN;
 	log_level log_stream = lWARN;
@@ -124,14 +152,16 @@ int main(int argc, char **argv) {
 	char *optarg = NULL;
 	int optind = 1;
 
+	startup_ms();
+
 	get_mac(mac);
 
 	while (optind < argc && strlen(argv[optind]) >= 2 && argv[optind][0] == '-') {
 		char *opt = argv[optind] + 1;
-		if (strstr("oabcdfmnpr", opt) && optind < argc - 1) {
+		if (strstr("oabcCdfmnprRsTVX", opt) && optind < argc - 1) {
 			optarg = argv[optind + 1];
 			optind += 2;
-		} else if (strstr("ltwz", opt)) {
+		} else if (strstr("Dltwz", opt)) {
 			optarg = NULL;
 			optind += 1;
 		} else {
@@ -150,10 +180,14 @@ int main(int argc, char **argv) {
 				char *c = next_param(NULL, ':');
 				char *s = next_param(NULL, ':');
 				char *m = next_param(NULL, ':');
+				char *r = next_param(NULL, ':');
+				char *n = next_param(NULL, ':');
 				if (t) alsa_buffer_time  = atoi(t) * 1000;
 				if (c) alsa_period_count = atoi(c);
 				if (s) alsa_sample_fmt = s;
 				if (m) alsa_mmap = atoi(m);
+				if (r) alsa_rewind = atoi(r);
+				if (n) alsa_native = atoi(n);
 #endif
 #if PORTAUDIO
 				pa_latency = (unsigned)atoi(optarg);
@@ -164,8 +198,20 @@ int main(int argc, char **argv) {
 			{
 				char *s = next_param(optarg, ':');
 				char *o = next_param(NULL, ':');
-				if (s) stream_buf_size = atoi(s) * 1024;
-				if (o) output_buf_size = atoi(o) * 1024;
+				char *m = next_param(NULL, ':');
+				if (s && strchr(s, 's')) {
+					stream_buf_secs = atoi(s);
+				} else if (s) {
+					stream_buf_size = atoi(s) * 1024;
+					stream_buf_secs = 0;
+				}
+				if (o && strchr(o, 's')) {
+					output_buf_secs = atoi(o);
+				} else if (o) {
+					output_buf_size = atoi(o) * 1024;
+					output_buf_secs = 0;
+				}
+				if (m) buffer_max = atoi(m) * 1024;
 			}
 			break;
 		case 'c':
@@ -210,7 +256,38 @@ int main(int argc, char **argv) {
 		case 'n':
 			name = optarg;
 			break;
+		case 's':
+			server_cache = optarg;
+			break;
+#if RESAMPLE
+		case 'R':
+			{
+				char *q = next_param(optarg, ':');
+				char *r = next_param(NULL, ':');
+				char *f = next_param(NULL, ':');
+				resample = true;
+				resample_quality = q;
+				if (r) resample_rate = atoi(r);
+				if (f) resample_family = atoi(f);
+			}
+			break;
+		case 'D':
+			resample_drift = true;
+			break;
+#endif
 #if ALSA
+		case 'V':
+			alsa_mixer = optarg;
+			break;
+		case 'T':
+			alsa_tsched = atoi(optarg);
+			break;
+		case 'X':
+			alsa_tune_max = atoi(optarg);
+			break;
+		case 'C':
+			alsa_idle = atoi(optarg);
+			break;
 		case 'p':
 			rt_priority = atoi(optarg);
 			if (rt_priority > 99 || rt_priority < 1) {
@@ -268,19 +345,49 @@ int main(int argc, char **argv) {
 	winsock_init();
 #endif
 
+	// outputbuf sized in seconds starts at cd rate so it is not resized for the first track at that rate
+	if (output_buf_secs) {
+		output_buf_size = output_buf_secs * 44100 * BYTES_PER_FRAME;
+	}
+
+	// initial sizes within the cap, the buffers sized in seconds are resized for the first track
+	if ((u64_t)stream_buf_size + output_buf_size > buffer_max) {
+		stream_buf_size = (unsigned)((u64_t)stream_buf_size * buffer_max / ((u64_t)stream_buf_size + output_buf_size));
+		output_buf_size = buffer_max - stream_buf_size;
+	}
+
 	stream_init(log_stream, stream_buf_size);
 
 #if ALSA
+#if RESAMPLE
+	// the process stage writes into free space of outputbuf so frames already played can not be re-rendered
+	if ((resample || resample_drift) && alsa_rewind) {
+		fprintf(stderr, "rewind on volume change disabled when resampling\n");
+		alsa_rewind = false;
+	}
+#endif
+	if (alsa_native && alsa_rewind) {
+		fprintf(stderr, "rewind on volume change disabled when buffering frames in device format\n");
+		alsa_rewind = false;
+	}
 	output_init(log_output, output_device, output_buf_size, alsa_buffer_time, alsa_period_count, alsa_sample_fmt, alsa_mmap, 
-				max_rate, rt_priority);
+				alsa_rewind, alsa_native, alsa_mixer, alsa_tsched, alsa_tune_max,
+				alsa_idle, max_rate, rt_priority);
 #endif
 #if PORTAUDIO
 	output_init(log_output, output_device, output_buf_size, pa_latency, max_rate);
 #endif
 
-	decode_init(log_decode, codecs);
+#if RESAMPLE
+	// before decode_init starts the decode thread, which uses the resampler once set
+	if (resample || resample_drift) {
+		resample_init(log_decode, resample_quality, resample_rate, resample_family, resample, resample_drift);
+	}
+#endif
+
+	decode_init(log_decode, codecs, stream_buf_secs, output_buf_secs, buffer_max);
 
-	slimproto(log_slimproto, server ? server_addr(server) : 0, mac, name);
+	slimproto(log_slimproto, server ? server_addr(server) : 0, mac, name, server_cache);
 	
 	decode_close();
 	stream_close();
@@ -89,8 +89,12 @@ static decode_state mpg_decode(void) {
 			m->mpg123_getformat(m->h, &rate, &channels, &enc);
 			
 			LOG_INFO("setting track_start");
-			output.next_sample_rate = rate;
-			output.track_start = outputbuf->writep;
+			output.next_sample_rate = _decode_newstream(rate);
+			if (!_output_track_start()) {
+				UNLOCK_O;
+				UNLOCK_S;
+				return DECODE_ERROR;
+			}
 			if (output.fade_mode) _checkfade(true);
 			decode.new_stream = false;
 
@@ -113,7 +117,7 @@ static decode_state mpg_decode(void) {
 	}
 
 	_buf_inc_readp(streambuf, bytes);
-	_buf_inc_writep(outputbuf, size);
+	_decode_inc_writep(size);
 
 	UNLOCK_O;
 	UNLOCK_S;
@@ -34,11 +34,15 @@
 #include <pa_mac_core.h>
 #endif
 #endif
+#if LINUX
+#include <sys/inotify.h>
+#endif
 
 #if ALSA
 
 #define MAX_SILENCE_FRAMES 1024
 #define MAX_DEVICE_LEN 128
+#define REWIND_GUARD_MS 10 // frames this close to the hardware pointer are not rewound
 
 static snd_pcm_format_t fmts[] = { SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_S16_LE,
 								   SND_PCM_FORMAT_UNKNOWN };
@@ -48,6 +52,20 @@ static snd_pcm_format_t fmts[] = { SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S24_LE,
 #define NATIVE_FORMAT SND_PCM_FORMAT_S32_BE
 #endif
 
+// negotiated when a handle is opened, applied to the device state below only once it becomes the current handle
+struct alsa_params {
+	char device[MAX_DEVICE_LEN + 1];    // as opened, plug prefixed if reopened for resampling
+	unsigned rate;
+	snd_pcm_uframes_t period_size;
+	bool mmap;
+	bool can_pause;
+	bool htstamp;
+	snd_pcm_hw_params_t *hw_params;     // filled for hw_cache if not NULL, cached is set once it holds those opened
+	bool cached;
+	char cache_device[MAX_DEVICE_LEN + 1];
+	unsigned cache_buffer_time, cache_period_count;
+};
+
 // ouput device
 static struct {
 	char device[MAX_DEVICE_LEN + 1];
@@ -56,10 +74,80 @@ static struct {
 	unsigned rate;
 	bool mmap;
 	u8_t *write_buf;
+	snd_pcm_uframes_t write_buf_frames;
+	// second handle opened ahead of a sample rate change at the next track boundary
+	snd_pcm_t *next_pcmp;
+	unsigned next_rate;
+	struct alsa_params next;
+	bool single_handle;                 // device refused a second open handle, reopen at rate changes instead
+	// current handle, set and used with outputbuf mutex held so it can be dropped or paused by other threads
+	snd_pcm_t *pcmp;
+	bool can_pause;
+	bool paused;
+	bool drop;                          // set by other threads, frames queued in the device are dropped by the output thread
+	bool htstamp;                       // hardware pointer is timestamped on the monotonic clock
+	snd_pcm_status_t *status;           // read by the output thread each period, allocated once as its loop never returns
+	bool rewind;                        // rewind and re-render device buffer on volume change
+	bool rewind_due;                    // set on volume change, the rewind is done by the output thread on its own handle
+	bool native;                        // allow decoders to store frames in outputbuf in the device format
+	bool direct;                        // allow the decode thread to pack frames straight into the mmap area
+	bool direct_fed;                    // decode thread has written to the device since the output thread last did
+	snd_pcm_uframes_t direct_offset;
+	// timer scheduling, sleep until the device fill level would fall to a margin rather than waking each period
+	unsigned tsched_ms;                 // configured margin, 0 if disabled
+	unsigned tsched_margin_ms;          // current margin, raised after near misses and decaying back to tsched_ms
+	unsigned tsched_ontime;             // wakeups on time since the margin last changed
+	// xrun driven tuning of buffer time and period count, applied by reopening the device at a track boundary
+	unsigned tune_max_time;             // max buffer time, 0 if disabled
+	unsigned tune_buffer_time;          // configured values, stepped back down to after a long clean period
+	unsigned tune_period_count;
+	unsigned xruns;                     // in the current interval
+	u32_t xrun_interval_start;
+	unsigned clean_intervals;
+	bool retune;                        // tuned params not yet in use, reopen at the next track boundary
+	bool reopen;
+	// idle, device closed once stopped for idle_ms so it can suspend, reopened with the params cached at last open
+	unsigned idle_ms;                   // 0 if disabled
+	event_event wake_e;                 // wakes the output thread while idle or waiting on the device
+	snd_pcm_hw_params_t *hw_cache;
+	char hw_cache_device[MAX_DEVICE_LEN + 1];
+	char hw_cache_opened[MAX_DEVICE_LEN + 1];
+	unsigned hw_cache_rate, hw_cache_buffer_time, hw_cache_period_count;
+	frames_t rewind_frames;             // frames most recently written to device which can be re-rendered from outputbuf
+	// hardware volume control, range in centi dB
+	snd_mixer_t *mixer;
+	snd_mixer_elem_t *mixer_elem;
+	long mixer_min, mixer_max;
 } alsa;
 
 static u8_t silencebuf[MAX_SILENCE_FRAMES * BYTES_PER_FRAME];
 
+#define MIXER_MUTE_CDB -9600
+
+#define TSCHED_DECAY_WAKEUPS 100
+
+#define XRUN_INTERVAL_MS     60000 // xruns are counted per interval
+#define XRUN_STEP_UP         2     // xruns in an interval which step buffering up
+#define XRUN_CLEAN_INTERVALS 30    // intervals without xruns before stepping back down
+#define XRUN_MAX_PERIODS     8
+
+// 16.16 gain for each dB of attenuation from 0 to -96 dB, maps audg gains to and from mixer dB values
+static const u32_t db_gain[] = {
+	65536, 58409, 52057, 46396, 41350, 36854, 32846, 29274,
+	26090, 23253, 20724, 18471, 16462, 14672, 13076, 11654,
+	10387,  9257,  8250,  7353,  6554,  5841,  5206,  4640,
+	 4135,  3685,  3285,  2927,  2609,  2325,  2072,  1847,
+	 1646,  1467,  1308,  1165,  1039,   926,   825,   735,
+	  655,   584,   521,   464,   414,   369,   328,   293,
+	  261,   233,   207,   185,   165,   147,   131,   117,
+	  104,    93,    83,    74,    66,    58,    52,    46,
+	   41,    37,    33,    29,    26,    23,    21,    18,
+	   16,    15,    13,    12,    10,     9,     8,     7,
+	    7,     6,     5,     5,     4,     4,     3,     3,
+	    3,     2,     2,     2,     2,     1,     1,     1,
+	    1,
+};
+
 #endif // ALSA
 
 #if PORTAUDIO
@@ -78,15 +166,47 @@ static log_level loglevel;
 
 struct outputstate output;
 
+struct outputstatus output_status;
+
+extern struct streamstatus stream_status;
+
+#define START_MIN_MS     300   // buffered before starting when the stream arrives at least START_RATIO faster than it plays
+#define START_RATIO      1.25
+#define START_HORIZON_MS 20000 // a slower stream starts with enough buffered to play this long before underrunning
+
 static struct buffer buf;
 
 struct buffer *outputbuf = &buf;
 
+// holds the tail of the outgoing track during a crossfade, only accessed with outputbuf mutex held
+static struct buffer cbuf;
+
+static struct buffer *crossbuf = &cbuf;
+
 static bool running = true;
 
 #define LOCK   mutex_lock(outputbuf->mutex)
 #define UNLOCK mutex_unlock(outputbuf->mutex)
 
+// dac clock drift against the local monotonic clock only, not the server or other players - slimproto carries no server
+// clock, the server corrects remaining offsets between synced players with pause and skip frames as before
+// tracked by an alpha-beta loop on the phase of the dac position, only accessed with outputbuf mutex held
+#define DRIFT_INTERVAL_US 1000000
+#define DRIFT_ALPHA       0.1    // fraction of the phase residual taken each interval
+#define DRIFT_BETA        0.005  // fraction of the phase residual taken into the rate each interval
+#define DRIFT_GLITCH_MS   50     // larger residuals are a gap in playback, not drift, so the loop is restarted
+
+static struct {
+	u64_t written;    // frames written to the device while it runs continuously
+	u64_t ref_us;     // clock and dac position the phase is measured from, 0 to restart
+	u64_t ref_pos;
+	u64_t last_us;
+	unsigned rate;
+	double phase;     // estimated dac phase ahead of the clock, frames
+	double ppm;       // estimated dac rate ahead of the clock
+	double residue;   // fraction of a track frame not yet counted as played
+} drift;
+
 #define MAX_SCALESAMPLE 0x7fffffffffffLL
 #define MIN_SCALESAMPLE -MAX_SCALESAMPLE
 
@@ -101,6 +221,177 @@ static inline s32_t to_gain(float f) {
 	return (s32_t)(f * 65536.0F);
 }
 
+// mix outgoing track from crossbuf into incoming track at outputbuf->readp in place, consuming crossbuf
+static void _crossfade_mix(frames_t frames, s32_t gain_in, s32_t gain_out) {
+	s32_t *ptr = (s32_t *)(void *)outputbuf->readp;
+	s32_t *cross_ptr = (s32_t *)(void *)crossbuf->readp;
+	frames_t count;
+
+	frames = min(frames, _buf_cont_read(crossbuf) / BYTES_PER_FRAME);
+	count = frames * 2;
+
+	while (count--) {
+		*ptr = gain(gain_out, *cross_ptr) + gain(gain_in, *ptr);
+		ptr++; cross_ptr++;
+	}
+
+	_buf_inc_readp(crossbuf, frames * BYTES_PER_FRAME);
+}
+
+// us from now until output.start_at, which is in gettime_ms jiffies
+static s64_t until_start_at(u64_t now_us) {
+	return (s64_t)(s32_t)(output.start_at - (u32_t)(now_us / 1000)) * 1000 - (s64_t)(now_us % 1000);
+}
+
+// called by output thread with mutex locked before writing, queued frames are ahead of the next write at now_us
+// the estimate is published for the resampler to correct, so tracks play at their nominal rate against the clock
+static void _drift_update(u64_t now_us, s64_t queued) {
+	u64_t pos = drift.written - queued;
+	double dt, err, res;
+
+	if (!drift.ref_us || drift.rate != output.current_sample_rate || now_us < drift.last_us) {
+		drift.ref_us = drift.last_us = now_us;
+		drift.ref_pos = pos;
+		drift.rate = output.current_sample_rate;
+		drift.phase = 0;
+		return;
+	}
+
+	if (now_us - drift.last_us < DRIFT_INTERVAL_US) {
+		return;
+	}
+
+	dt = (double)(now_us - drift.last_us) / 1000000;
+	err = (double)(s64_t)(pos - drift.ref_pos) - (double)(now_us - drift.ref_us) * drift.rate / 1000000;
+
+	drift.phase += drift.ppm * drift.rate * dt / 1000000;
+	res = err - drift.phase;
+	drift.last_us = now_us;
+
+	if (res > (double)drift.rate * DRIFT_GLITCH_MS / 1000 || res < -(double)drift.rate * DRIFT_GLITCH_MS / 1000) {
+		LOG_DEBUG("drift residual: %.0f frames, restarting", res);
+		drift.ref_us = 0;
+		return;
+	}
+
+	drift.phase += DRIFT_ALPHA * res;
+	drift.ppm += DRIFT_BETA * res * 1000000 / (drift.rate * dt);
+	if (drift.ppm > DRIFT_MAX_PPM) drift.ppm = DRIFT_MAX_PPM;
+	if (drift.ppm < -DRIFT_MAX_PPM) drift.ppm = -DRIFT_MAX_PPM;
+
+	output.drift_ppb = (s32_t)(drift.ppm * 1000);
+
+	LOG_SDEBUG("drift: %.3f ppm residual: %.1f frames", drift.ppm, res);
+}
+
+// called with mutex locked in BUFFER state, true once playback can start without the buffer being projected to
+// underrun, the buffered time drains at the rate the stream arrives slower than it plays - uses the server threshold
+// until the stream throughput and bitrate are known
+static bool _start_ready(frames_t frames) {
+	struct streamstatus s;
+	u32_t buffered_ms, need_ms;
+	double ratio;
+
+	snapshot_read(&s, &stream_status, sizeof(s));
+
+	if (!output.bitrate || !output.next_sample_rate || (!s.throughput && s.state > DISCONNECT)) {
+		return frames > output.threshold * output.next_sample_rate / 100;
+	}
+
+	buffered_ms = (u32_t)((u64_t)frames * 1000 / output.next_sample_rate + (u64_t)s.full * 1000 / output.bitrate);
+
+	if (s.state <= DISCONNECT) {
+		// all of the stream is buffered
+		need_ms = 0;
+		ratio = 0;
+	} else {
+		ratio = (double)s.throughput / output.bitrate;
+		need_ms = START_MIN_MS;
+		if (ratio < START_RATIO) {
+			need_ms += (u32_t)(START_HORIZON_MS * (1 - ratio / START_RATIO));
+		}
+	}
+
+	LOG_SDEBUG("start: buffered: %u ms need: %u ms", buffered_ms, need_ms);
+
+	if (buffered_ms < need_ms) {
+		return false;
+	}
+
+	LOG_INFO("start: buffered: %u ms need: %u ms throughput: %u bitrate: %u bytes/s ratio: %.2f server threshold: %u ms",
+			 buffered_ms, need_ms, s.throughput, output.bitrate, ratio, output.threshold * 10);
+
+	return true;
+}
+
+// called with mutex locked, publishes state for the controller to read without the mutex, waking it as the buffer
+// runs out while playing as it reports this to the server
+static void _output_publish(void) {
+	bool empty = output_status.state == OUTPUT_RUNNING && !output_status.full;
+
+	snapshot_begin(output_status);
+	output_status.state = output.state;
+	output_status.full = _buf_used(outputbuf);
+	output_status.size = outputbuf->size;
+	output_status.frames_played = output.frames_played_dmp;
+	output_status.device_frames = output.device_frames;
+	output_status.current_sample_rate = output.current_sample_rate;
+	output_status.updated_us = output.updated_us;
+	snapshot_end(output_status);
+
+	if (!empty && output_status.state == OUTPUT_RUNNING && !output_status.full) {
+		wake_controller();
+	}
+}
+
+// called with mutex locked, track frames played by frames written to the device, which were resampled by the drift
+static frames_t _drift_played(frames_t frames) {
+	s32_t whole;
+
+	if (!output.drift) {
+		return frames;
+	}
+
+	drift.residue += (double)frames * output.drift_ppb / 1000000000;
+	whole = (s32_t)drift.residue;
+	drift.residue -= whole;
+
+	return frames - whole;
+}
+
+// wait for a missing device, returning as soon as a device node is created or made accessible under /dev/snd,
+// otherwise after timeout
+static void hotplug_wait(unsigned timeout_ms) {
+#if LINUX
+	static int fd = -1; // -2 once watching has failed, falling back to sleeping for timeout
+	struct pollfd pfd;
+	char events[1024];
+
+	if (fd == -1) {
+		if ((fd = inotify_init1(IN_NONBLOCK)) < 0 || inotify_add_watch(fd, "/dev/snd", IN_CREATE | IN_ATTRIB) < 0) {
+			LOG_INFO("unable to watch /dev/snd: %s", strerror(errno));
+			if (fd >= 0) {
+				close(fd);
+			}
+			fd = -2;
+		}
+	}
+
+	if (fd >= 0) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeout_ms) > 0) {
+			LOG_DEBUG("device change under /dev/snd");
+			// udev may still be setting up the device, events queued while it does so are cleared by later calls
+			usleep(50000);
+			while (read(fd, events, sizeof(events)) > 0);
+		}
+		return;
+	}
+#endif
+	sleep(timeout_ms / 1000);
+}
+
 #if ALSA
 
 void list_devices(void) {
@@ -199,7 +490,64 @@ static bool pcm_probe(const char *device) {
 	return true;
 }
 
-static int alsa_open(snd_pcm_t **pcmp, const char *device, unsigned sample_rate, unsigned buffer_time, unsigned period_count) {
+// complete opening once hw params are set
+static int alsa_setup(snd_pcm_t **pcmp, struct alsa_params *p, snd_pcm_hw_params_t *hw_params, unsigned sample_rate) {
+	int err;
+
+	// get period_size
+	if ((err = snd_pcm_hw_params_get_period_size(hw_params, &p->period_size, 0)) < 0) {
+		LOG_ERROR("unable to get period size: %s", snd_strerror(err));
+		return err;
+	}
+
+	// get buffer_size
+	snd_pcm_uframes_t buffer_size;
+	if ((err = snd_pcm_hw_params_get_buffer_size(hw_params, &buffer_size)) < 0) {
+		LOG_ERROR("unable to get buffer size: %s", snd_strerror(err));
+		return err;
+	}
+
+	LOG_INFO("buffer size: %u period size: %u", buffer_size, p->period_size);
+
+	// dump info
+	if (loglevel == lSDEBUG) {
+		static snd_output_t *debug_output;
+		snd_output_stdio_attach(&debug_output, stderr, 0);
+		snd_pcm_dump(*pcmp, debug_output);
+	}
+
+	p->can_pause = snd_pcm_hw_params_can_pause(hw_params);
+
+	snd_pcm_sw_params_t *sw_params;
+	snd_pcm_sw_params_alloca(&sw_params);
+	if ((err = snd_pcm_sw_params_current(*pcmp, sw_params)) < 0) {
+		LOG_WARN("unable to get sw params: %s", snd_strerror(err));
+	} else {
+		// timestamp the hardware pointer on the same clock as gettime_us so the device position can be interpolated
+		p->htstamp = snd_pcm_sw_params_set_tstamp_mode(*pcmp, sw_params, SND_PCM_TSTAMP_ENABLE) >= 0 &&
+			snd_pcm_sw_params_set_tstamp_type(*pcmp, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC) >= 0;
+		if (!p->htstamp) {
+			LOG_INFO("monotonic hardware timestamps not available");
+		}
+		// timer scheduled output wakes on its own timeout rather than each period, so only wake early if the device empties
+		if (alsa.tsched_ms && (err = snd_pcm_sw_params_set_avail_min(*pcmp, sw_params, buffer_size)) < 0) {
+			LOG_WARN("unable to set avail_min: %s", snd_strerror(err));
+		}
+		if ((err = snd_pcm_sw_params(*pcmp, sw_params)) < 0) {
+			LOG_WARN("unable to set sw params: %s", snd_strerror(err));
+			p->htstamp = false;
+		}
+	}
+
+	// this indicates we have opened the device ok
+	p->rate = sample_rate;
+
+	return 0;
+}
+
+// open a handle, negotiating into p rather than the state of the current handle which may still be playing
+static int alsa_open(snd_pcm_t **pcmp, struct alsa_params *p, const char *device, unsigned sample_rate, unsigned buffer_time,
+					 unsigned period_count, int mode) {
 	int err;
 	snd_pcm_hw_params_t *hw_params;
 	snd_pcm_hw_params_alloca(&hw_params);
@@ -208,20 +556,41 @@ static int alsa_open(snd_pcm_t **pcmp, const char *device, unsigned sample_rate,
 	if (*pcmp) alsa_close(*pcmp);
 
 	// reset params
-	alsa.rate = 0;
-	alsa.period_size = 0;
-	strcpy(alsa.device, device);
+	p->rate = 0;
+	p->period_size = 0;
+	p->mmap = alsa.mmap;
+	p->can_pause = p->htstamp = false;
+	p->cached = false;
+	strcpy(p->device, device);
 
 	if (strlen(device) > MAX_DEVICE_LEN - 4 - 1) {
 		LOG_ERROR("device name too long: %s", device);
 		return -1;
 	}
 
+	// reopen with the params negotiated when last opened with the same settings rather than negotiating them again
+	if (alsa.hw_cache && alsa.hw_cache_rate == sample_rate && alsa.hw_cache_buffer_time == buffer_time &&
+		alsa.hw_cache_period_count == period_count && !strcmp(alsa.hw_cache_device, device)) {
+		strcpy(p->device, alsa.hw_cache_opened);
+		if ((err = snd_pcm_open(pcmp, p->device, SND_PCM_STREAM_PLAYBACK, mode)) >= 0) {
+			snd_pcm_hw_params_copy(hw_params, alsa.hw_cache);
+			if ((err = snd_pcm_hw_params(*pcmp, hw_params)) >= 0) {
+				LOG_INFO("opened device %s using cached params sample rate: %u", p->device, sample_rate);
+				return alsa_setup(pcmp, p, hw_params, sample_rate);
+			}
+			snd_pcm_close(*pcmp);
+		}
+		*pcmp = NULL;
+		LOG_INFO("unable to use cached params: %s", snd_strerror(err));
+		strcpy(p->device, device);
+	}
+
 	bool retry;
 	do {
 		// open device
-		if ((err = snd_pcm_open(pcmp, alsa.device, SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+		if ((err = snd_pcm_open(pcmp, p->device, SND_PCM_STREAM_PLAYBACK, mode)) < 0) {
 			LOG_ERROR("playback open error: %s", snd_strerror(err));
+			*pcmp = NULL;
 			return err;
 		}
 
@@ -233,7 +602,7 @@ static int alsa_open(snd_pcm_t **pcmp, const char *device, unsigned sample_rate,
 		}
 
 		// open hw: devices without resampling, if sample rate fails try plughw: with resampling
-		bool hw = !strncmp(alsa.device, "hw:", 3);
+		bool hw = !strncmp(p->device, "hw:", 3);
 		retry = false;
 
 		if ((err = snd_pcm_hw_params_set_rate_resample(*pcmp, hw_params, !hw)) < 0) {
@@ -243,9 +612,9 @@ static int alsa_open(snd_pcm_t **pcmp, const char *device, unsigned sample_rate,
 
 		if ((err = snd_pcm_hw_params_set_rate(*pcmp, hw_params, sample_rate, 0)) < 0) {
 			if (hw) {
-				strcpy(alsa.device + 4, device);
-				memcpy(alsa.device, "plug", 4);
-				LOG_INFO("reopening device %s in plug mode as %s for resampling", device, alsa.device);
+				strcpy(p->device + 4, device);
+				memcpy(p->device, "plug", 4);
+				LOG_INFO("reopening device %s in plug mode as %s for resampling", device, p->device);
 				snd_pcm_close(*pcmp);
 				retry = true;
 			}
@@ -254,19 +623,19 @@ static int alsa_open(snd_pcm_t **pcmp, const char *device, unsigned sample_rate,
 	} while (retry);
 
 	// set access 
-	if (!alsa.mmap || snd_pcm_hw_params_set_access(*pcmp, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0) {
+	if (!p->mmap || snd_pcm_hw_params_set_access(*pcmp, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0) {
 		if ((err = snd_pcm_hw_params_set_access(*pcmp, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
 			LOG_ERROR("access type not available: %s", snd_strerror(err));
 			return err;
 		}
-		alsa.mmap = false;
+		p->mmap = false;
 	}
 
 	// set the sample format
 	snd_pcm_format_t *fmt = alsa.format ? &alsa.format : (snd_pcm_format_t *)fmts;
 	do {
 		if (snd_pcm_hw_params_set_format(*pcmp, hw_params, *fmt) >= 0) {
-			LOG_INFO("opened device %s using format: %s sample rate: %u mmap: %u", alsa.device, snd_pcm_format_name(*fmt), sample_rate, alsa.mmap);
+			LOG_INFO("opened device %s using format: %s sample rate: %u mmap: %u", p->device, snd_pcm_format_name(*fmt), sample_rate, p->mmap);
 			alsa.format = *fmt;
 			break;
 		}
@@ -301,50 +670,454 @@ static int alsa_open(snd_pcm_t **pcmp, const char *device, unsigned sample_rate,
 		return err;
 	}
 
-	// get period_size
-	if ((err = snd_pcm_hw_params_get_period_size(hw_params, &alsa.period_size, 0)) < 0) {
-		LOG_ERROR("unable to get period size: %s", snd_strerror(err));
+	LOG_INFO("buffer time: %u period count: %u", time, count);
+
+	// set params
+	if ((err = snd_pcm_hw_params(*pcmp, hw_params)) < 0) {
+		LOG_ERROR("unable to set hw params: %s", snd_strerror(err));
 		return err;
 	}
 
-	// get buffer_size
-	snd_pcm_uframes_t buffer_size;
-	if ((err = snd_pcm_hw_params_get_buffer_size(hw_params, &buffer_size)) < 0) {
-		LOG_ERROR("unable to get buffer size: %s", snd_strerror(err));
-		return err;
+	if (p->hw_params) {
+		snd_pcm_hw_params_copy(p->hw_params, hw_params);
+		strcpy(p->cache_device, device);
+		p->cache_buffer_time = buffer_time;
+		p->cache_period_count = period_count;
+		p->cached = true;
 	}
 
-	LOG_INFO("buffer time: %u period count: %u buffer size: %u period size: %u", time, count, buffer_size, alsa.period_size);
+	return alsa_setup(pcmp, p, hw_params, sample_rate);
+}
+
+// open and prepare a second handle at the sample rate of the next track while the current one is playing
+// the device is opened non blocking so a device which only allows one open handle fails immediately
+static void alsa_preopen(unsigned sample_rate) {
+	int err;
+
+	LOG_INFO("pre-opening output device: %s at: %u", output.device, sample_rate);
+
+	err = alsa_open(&alsa.next_pcmp, &alsa.next, output.device, sample_rate, output.buffer_time, output.period_count,
+					SND_PCM_NONBLOCK);
+
+	if (!err && (err = snd_pcm_nonblock(alsa.next_pcmp, 0)) < 0) {
+		LOG_INFO("unable to set blocking mode: %s", snd_strerror(err));
+	}
+
+	if (err) {
+		if (err == -EBUSY) {
+			LOG_INFO("device does not allow a second handle - reopening at sample rate changes");
+			alsa.single_handle = true;
+		}
+		if (alsa.next_pcmp) {
+			alsa_close(alsa.next_pcmp);
+			alsa.next_pcmp = NULL;
+		}
+	}
+
+	// remember attempt so a failed pre-open is not retried for this track
+	alsa.next_rate = sample_rate;
+}
+
+// make what was negotiated for a handle that of the current handle as it is swapped in, the buffer writes are packed in
+// is grown for its period and its params cached for reopening
+static int alsa_apply(struct alsa_params *p) {
+	strcpy(alsa.device, p->device);
+	alsa.rate = p->rate;
+	alsa.period_size = p->period_size;
+	alsa.mmap = p->mmap;
+	alsa.can_pause = p->can_pause;
+	alsa.htstamp = p->htstamp;
+
+	if (p->cached && alsa.hw_cache) {
+		if (p->hw_params != alsa.hw_cache) {
+			snd_pcm_hw_params_copy(alsa.hw_cache, p->hw_params);
+		}
+		strcpy(alsa.hw_cache_device, p->cache_device);
+		strcpy(alsa.hw_cache_opened, p->device);
+		alsa.hw_cache_rate = p->rate;
+		alsa.hw_cache_buffer_time = p->cache_buffer_time;
+		alsa.hw_cache_period_count = p->cache_period_count;
+	}
 
 	// create an intermediate buffer for non mmap case for all but NATIVE_FORMAT
 	// this is used to pack samples into the output format before calling writei
-	if (!alsa.mmap && !alsa.write_buf && alsa.format != NATIVE_FORMAT) {
-		alsa.write_buf = malloc(alsa.period_size * BYTES_PER_FRAME);
-		if (!alsa.write_buf) {
+	// period_size grows with sample rate for a fixed buffer time so grow it when a larger period is opened
+	if (!alsa.mmap && (alsa.format != NATIVE_FORMAT || alsa.rewind || alsa.native) && alsa.period_size > alsa.write_buf_frames) {
+		u8_t *write_buf = realloc(alsa.write_buf, alsa.period_size * BYTES_PER_FRAME);
+		if (!write_buf) {
 			LOG_ERROR("unable to malloc write_buf");
+			alsa.rate = 0;
 			return -1;
 		}
+		alsa.write_buf = write_buf;
+		alsa.write_buf_frames = alsa.period_size;
 	}
 
-	// set params
-	if ((err = snd_pcm_hw_params(*pcmp, hw_params)) < 0) {
-		LOG_ERROR("unable to set hw params: %s", snd_strerror(err));
-		return err;
+	return 0;
+}
+
+// called by output thread with mutex locked before closing a device paused in hardware, moves readp back over the frames
+// it holds so they are written again once reopened - returns false if they are not all intact in outputbuf as written
+static bool _alsa_unqueue(snd_pcm_t *pcmp) {
+	snd_pcm_sframes_t frames;
+	frames_t intact;
+
+	if (snd_pcm_delay(pcmp, &frames) < 0 || frames < 0) {
+		return false;
 	}
 
-	// dump info
-	if (loglevel == lSDEBUG) {
-		static snd_output_t *debug_output;
-		snd_output_stdio_attach(&debug_output, stderr, 0);
-		snd_pcm_dump(*pcmp, debug_output);
+	// consumed frames before readp remain intact until the decoder writes over them, unless gain was applied in place
+	intact = _buf_space(outputbuf) / output.frame_bytes;
+	if (intact) --intact;
+
+	if ((frames_t)frames > intact || (frames_t)frames > alsa.rewind_frames || (frames_t)frames > output.frames_played ||
+		(output.frame_bytes == BYTES_PER_FRAME && !alsa.mmap && alsa.format == NATIVE_FORMAT && !alsa.rewind)) {
+		LOG_INFO("paused device holds frames which can not be restored - not closing");
+		return false;
 	}
 
-	// this indicates we have opened the device ok
-	alsa.rate = sample_rate;
+	outputbuf->readp -= frames * output.frame_bytes;
+	if (outputbuf->readp < outputbuf->buf) {
+		outputbuf->readp += outputbuf->size;
+	}
+	output.frames_played -= frames;
+
+	LOG_INFO("restored %d frames held by paused device", (int)frames);
+	return true;
+}
+
+// withdraw the current handle from other threads before it is closed or replaced
+static void alsa_unpublish(void) {
+	LOCK;
+	alsa.pcmp = NULL;
+	alsa.paused = false;
+	alsa.drop = false;
+	alsa.rewind_frames = 0;
+	alsa.direct_fed = false;
+	UNLOCK;
+}
+
+// timer scheduling: ms until the device fill level falls to the margin
+static int tsched_timeout(snd_pcm_t *pcmp) {
+	snd_pcm_sframes_t delay, margin = (snd_pcm_sframes_t)alsa.tsched_margin_ms * alsa.rate / 1000;
+
+	if (snd_pcm_delay(pcmp, &delay) < 0 || delay <= margin) {
+		return 0;
+	}
+
+	return (int)((delay - margin) * 1000 / alsa.rate);
+}
+
+// raise the margin when a wakeup finds the device close to running dry, decay it back once wakeups are on time
+static void tsched_adapt(snd_pcm_t *pcmp, bool xrun) {
+	snd_pcm_sframes_t delay = 0;
+	unsigned max_ms = output.buffer_time / 2000;
+
+	if (!xrun && snd_pcm_delay(pcmp, &delay) < 0) {
+		return;
+	}
+
+	if (xrun || delay < (snd_pcm_sframes_t)alsa.tsched_margin_ms * alsa.rate / 2000) {
+		if (alsa.tsched_margin_ms < max_ms) {
+			alsa.tsched_margin_ms = min(alsa.tsched_margin_ms * 2, max_ms);
+			LOG_INFO("%s - timer margin raised to: %u ms", xrun ? "xrun" : "late wakeup", alsa.tsched_margin_ms);
+		}
+		alsa.tsched_ontime = 0;
+	} else if (++alsa.tsched_ontime >= TSCHED_DECAY_WAKEUPS && alsa.tsched_margin_ms > alsa.tsched_ms) {
+		alsa.tsched_margin_ms = max(alsa.tsched_margin_ms * 9 / 10, alsa.tsched_ms);
+		alsa.tsched_ontime = 0;
+		LOG_DEBUG("timer margin reduced to: %u ms", alsa.tsched_margin_ms);
+	}
+}
+
+static int wake_fd(void) {
+#if EVENTFD
+	return alsa.wake_e;
+#else
+	return alsa.wake_e.fds[0];
+#endif
+}
+
+// block output thread while idle until woken by output_wake
+static void idle_wait(void) {
+	struct pollfd pfd;
+	pfd.fd = wake_fd();
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, -1) > 0) {
+		wake_clear(pfd.fd);
+	}
+}
+
+#define MAX_POLL_FDS 8
+
+// called by output thread without the mutex locked, waits as snd_pcm_wait for space in the device or for output_wake,
+// setting woken, the mutex is only locked to use the handle as the decode thread may write to it direct
+static int alsa_wait(snd_pcm_t *pcmp, int timeout, bool *woken) {
+	struct pollfd pfds[MAX_POLL_FDS + 1];
+	unsigned short revents;
+	int count, err;
+
+	LOCK;
+	count = snd_pcm_poll_descriptors(pcmp, pfds + 1, MAX_POLL_FDS);
+	UNLOCK;
+
+	if (count < 0) {
+		return count;
+	}
+
+	pfds[0].fd = wake_fd();
+	pfds[0].events = POLLIN;
+
+	if ((err = poll(pfds, count + 1, timeout)) <= 0) {
+		return err < 0 && errno != EINTR ? -errno : 0;
+	}
+
+	if (pfds[0].revents) {
+		wake_clear(pfds[0].fd);
+		*woken = true;
+		return 0;
+	}
+
+	LOCK;
+	if ((err = snd_pcm_poll_descriptors_revents(pcmp, pfds + 1, count, &revents)) == 0 && (revents & POLLERR)) {
+		switch (snd_pcm_state(pcmp)) {
+		case SND_PCM_STATE_XRUN:         err = -EPIPE; break;
+		case SND_PCM_STATE_SUSPENDED:    err = -ESTRPIPE; break;
+		case SND_PCM_STATE_DISCONNECTED: err = -ENODEV; break;
+		default:                         err = -EIO; break;
+		}
+	}
+	UNLOCK;
+
+	return err < 0 ? err : (revents & POLLOUT) ? 1 : 0;
+}
+
+// frames queued in the device ahead of a frame written at now_us, interpolated from the timestamp of the hardware
+// pointer as it may only move at period interrupts
+static snd_pcm_sframes_t alsa_queued(snd_pcm_t *pcmp, u64_t now_us) {
+	snd_pcm_sframes_t delay;
+	snd_pcm_uframes_t avail;
+	snd_htimestamp_t ts;
+
+	if (snd_pcm_delay(pcmp, &delay) < 0) {
+		return 0;
+	}
+
+	if (alsa.htstamp && snd_pcm_state(pcmp) == SND_PCM_STATE_RUNNING && snd_pcm_htimestamp(pcmp, &avail, &ts) == 0 &&
+		(ts.tv_sec || ts.tv_nsec)) {
+		u64_t ts_us = (u64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		if (now_us > ts_us) {
+			delay -= (snd_pcm_sframes_t)((now_us - ts_us) * alsa.rate / 1000000);
+		}
+	}
+
+	return delay > 0 ? delay : 0;
+}
+
+// recover from a device error, counting xruns
+static int alsa_recover(snd_pcm_t *pcmp, int err) {
+	if (err == -EPIPE) {
+		++alsa.xruns;
+		++output.xruns;
+		drift.ref_us = 0;
+		alsa.direct_fed = false;
+		if (alsa.tsched_ms) {
+			tsched_adapt(pcmp, true);
+		}
+	}
+	return snd_pcm_recover(pcmp, err, 1);
+}
+
+// called by output thread, reports the xrun rate each interval and steps buffering up after repeated xruns or back
+// down towards the configured latency after a long clean period
+static void xrun_tune(void) {
+	unsigned buffer_time = output.buffer_time;
+	unsigned period_count = output.period_count;
+	u32_t now = gettime_ms();
 
+	if (now - alsa.xrun_interval_start < XRUN_INTERVAL_MS) {
+		return;
+	}
+
+	output.xrun_rate = alsa.xruns;
+
+	if (alsa.xruns) {
+		LOG_INFO("xruns: %u in last %u secs, total: %u", alsa.xruns, (now - alsa.xrun_interval_start) / 1000, output.xruns);
+	}
+
+	if (alsa.tune_max_time) {
+		if (alsa.xruns >= XRUN_STEP_UP) {
+			alsa.clean_intervals = 0;
+			if (buffer_time < alsa.tune_max_time) {
+				buffer_time = min(buffer_time * 2, alsa.tune_max_time);
+			} else if (period_count < XRUN_MAX_PERIODS) {
+				period_count++;
+			}
+		} else if (alsa.xruns) {
+			alsa.clean_intervals = 0;
+		} else if (++alsa.clean_intervals >= XRUN_CLEAN_INTERVALS) {
+			alsa.clean_intervals = 0;
+			if (period_count > alsa.tune_period_count) {
+				period_count--;
+			} else if (buffer_time > alsa.tune_buffer_time) {
+				buffer_time = max(buffer_time / 2, alsa.tune_buffer_time);
+			}
+		}
+
+		if (buffer_time != output.buffer_time || period_count != output.period_count) {
+			LOG_INFO("xrun tuning buffer time: %u -> %u period count: %u -> %u, reopen at next track boundary",
+					 output.buffer_time, buffer_time, output.period_count, period_count);
+			output.buffer_time = buffer_time;
+			output.period_count = period_count;
+			alsa.retune = true;
+		}
+	}
+
+	alsa.xruns = 0;
+	alsa.xrun_interval_start = now;
+}
+
+// size of device frames which the process stage can pack outputbuf frames into, 0 if the device format is not supported
+static unsigned native_frame_bytes(void) {
+#if SL_LITTLE_ENDIAN
+	if (alsa.native) {
+		switch (alsa.format) {
+		case SND_PCM_FORMAT_S16_LE: return 4;
+		case SND_PCM_FORMAT_S24_3LE: return 6;
+		default: break;
+		}
+	}
+#endif
 	return 0;
 }
 
+// scale frames already in device format, outputbuf is not altered so they can be re-rendered
+static void gain_native(u8_t *optr, u8_t *iptr, frames_t cnt, s32_t gainL, s32_t gainR) {
+	if (output.frame_bytes == 4) {
+		s16_t *o = (s16_t *)(void *)optr;
+		s16_t *i = (s16_t *)(void *)iptr;
+		while (cnt--) {
+			*(o++) = gain(gainL, *(i++) << 16) >> 16;
+			*(o++) = gain(gainR, *(i++) << 16) >> 16;
+		}
+	} else {
+		while (cnt--) {
+			s32_t lsample = gain(gainL, iptr[0] << 8 | iptr[1] << 16 | iptr[2] << 24);
+			s32_t rsample = gain(gainR, iptr[3] << 8 | iptr[4] << 16 | iptr[5] << 24);
+			*(optr++) = (lsample & 0x0000ff00) >>  8;
+			*(optr++) = (lsample & 0x00ff0000) >> 16;
+			*(optr++) = (lsample & 0xff000000) >> 24;
+			*(optr++) = (rsample & 0x0000ff00) >>  8;
+			*(optr++) = (rsample & 0x00ff0000) >> 16;
+			*(optr++) = (rsample & 0xff000000) >> 24;
+			iptr += 6;
+		}
+	}
+}
+
+// centi dB for a 16.16 gain of unity or below, interpolating between table entries
+static long gain_to_cdb(u32_t g) {
+	int i;
+
+	if (g >= FIXED_ONE) return 0;
+	if (g <= db_gain[-MIXER_MUTE_CDB / 100]) return MIXER_MUTE_CDB;
+
+	for (i = 1; g < db_gain[i]; ++i);
+
+	return -(i - 1) * 100 - (long)(db_gain[i - 1] - g) * 100 / (long)(db_gain[i - 1] - db_gain[i]);
+}
+
+static u32_t cdb_to_gain(long cdb) {
+	long i, frac;
+
+	if (cdb >= 0) return FIXED_ONE;
+	if (cdb <= MIXER_MUTE_CDB) return 0;
+
+	i = -cdb / 100;
+	frac = -cdb % 100;
+
+	return db_gain[i] - (db_gain[i] - db_gain[i + 1]) * frac / 100;
+}
+
+// digital gain for the part of a channel's gain not covered by the mixer, unity if the mixer covers all of it
+static u32_t residual_gain(u32_t g, long mixer_cdb) {
+	if (g == 0) return 0;
+	if (g >= FIXED_ONE && mixer_cdb == 0) return g;
+	return cdb_to_gain(gain_to_cdb(g) - mixer_cdb);
+}
+
+static void mixer_init(const char *device, const char *control) {
+	char card[MAX_DEVICE_LEN + 1] = "default";
+	const char *hw = strstr(device, "hw:");
+	snd_mixer_elem_t *elem = NULL;
+	int err;
+
+	// mixer of the card for hw: and plughw: devices, otherwise the default mixer
+	if (hw && strlen(hw) <= MAX_DEVICE_LEN) {
+		char *comma;
+		strcpy(card, hw);
+		if ((comma = strchr(card, ','))) *comma = '\0';
+	}
+
+	if ((err = snd_mixer_open(&alsa.mixer, 0)) < 0) {
+		LOG_WARN("mixer open error: %s", snd_strerror(err));
+		alsa.mixer = NULL;
+		return;
+	}
+
+	if ((err = snd_mixer_attach(alsa.mixer, card)) < 0 || (err = snd_mixer_selem_register(alsa.mixer, NULL, NULL)) < 0 ||
+		(err = snd_mixer_load(alsa.mixer)) < 0) {
+		LOG_WARN("mixer %s error: %s", card, snd_strerror(err));
+		snd_mixer_close(alsa.mixer);
+		alsa.mixer = NULL;
+		return;
+	}
+
+	if (!strcmp(control, "auto")) {
+		// first active control with a playback volume in dB
+		for (elem = snd_mixer_first_elem(alsa.mixer); elem; elem = snd_mixer_elem_next(elem)) {
+			if (snd_mixer_selem_is_active(elem) && snd_mixer_selem_has_playback_volume(elem) &&
+				snd_mixer_selem_get_playback_dB_range(elem, &alsa.mixer_min, &alsa.mixer_max) >= 0 &&
+				alsa.mixer_max > alsa.mixer_min) {
+				break;
+			}
+		}
+	} else {
+		snd_mixer_selem_id_t *sid;
+		snd_mixer_selem_id_alloca(&sid);
+		memset(sid, 0, snd_mixer_selem_id_sizeof());
+		snd_mixer_selem_id_set_index(sid, 0);
+		snd_mixer_selem_id_set_name(sid, control);
+		elem = snd_mixer_find_selem(alsa.mixer, sid);
+		if (elem && (snd_mixer_selem_get_playback_dB_range(elem, &alsa.mixer_min, &alsa.mixer_max) < 0 ||
+					 alsa.mixer_max <= alsa.mixer_min)) {
+			LOG_WARN("mixer control %s has no playback dB range", control);
+			elem = NULL;
+		}
+	}
+
+	if (!elem) {
+		LOG_WARN("mixer control %s not found on %s - using digital volume", control, card);
+		snd_mixer_close(alsa.mixer);
+		alsa.mixer = NULL;
+		return;
+	}
+
+	alsa.mixer_elem = elem;
+
+	LOG_INFO("hardware volume using %s control: %s range: %ld to %ld centi dB", card, snd_mixer_selem_get_name(elem),
+			 alsa.mixer_min, alsa.mixer_max);
+}
+
+static void alsa_close_next(void) {
+	if (alsa.next_pcmp) {
+		LOG_DEBUG("closing pre-opened device at: %u", alsa.next_rate);
+		alsa_close(alsa.next_pcmp);
+		alsa.next_pcmp = NULL;
+	}
+	alsa.next_rate = 0;
+}
+
 #endif // ALSA
 
 #if PORTAUDIO
@@ -451,20 +1224,23 @@ bool probe_thread_running = false;
 static void *pa_probe() {
 	// this is a hack to partially support hot plugging of devices
 	// we rely on terminating and reinitalising PA to get an updated list of devices and use name for output.device
+	// the stream has failed so the mutex is only held to reopen it, rather than blocking the decoder while probing
 	while (probe_thread_running) {
 		LOG_INFO("probing device %s", output.device);
 		LOCK;
+		pa.stream = NULL;
+		UNLOCK;
 		Pa_Terminate();
 		Pa_Initialize();
-		pa.stream = NULL;
 		if (pa_device_id(output.device) != -1) {
 			LOG_INFO("found");
+			LOCK;
 			probe_thread_running = false;
 			_pa_open();
+			UNLOCK;
 		} else {
-			sleep(5);
+			hotplug_wait(5000);
 		}
-		UNLOCK;
 	}
 
 	return 0;
@@ -475,6 +1251,12 @@ void _pa_open(void) {
 	PaError err = paNoError;
 	int device_id;
 
+	// the probe thread terminates and reinitialises portaudio without the mutex, it opens the stream once found
+	if (probe_thread_running) {
+		LOG_DEBUG("probing device - not opening");
+		return;
+	}
+
 	if (pa.stream) {
 		if ((err = Pa_CloseStream(pa.stream)) != paNoError) {
 			LOG_WARN("error closing stream: %s", Pa_GetErrorText(err));
@@ -523,6 +1305,10 @@ void _pa_open(void) {
 
 		pa.rate = output.current_sample_rate;
 
+		if (output.strm_received) {
+			LOG_INFO("device open %u ms after strm", gettime_ms() - output.strm_received);
+		}
+
 		if ((err = Pa_SetStreamFinishedCallback(pa.stream, pa_stream_finished)) != paNoError) {
 			LOG_WARN("error setting finish callback: %s", Pa_GetErrorText(err));
 		}
@@ -556,9 +1342,49 @@ void _pa_open(void) {
 static void *output_thread(void *arg) {
 	snd_pcm_t *pcmp = NULL;
 	bool start = true;
-	bool output_off = false, probe_device = (arg != NULL);
+	bool output_off = false, idle = false, probe_device = (arg != NULL);
+	u32_t stopped_since = 0;
+	unsigned preopen_rate = 0;
 	int err;
 
+	// the device is probed and memory prefaulted here rather than in output_init so they overlap server discovery
+	// and codec loading, slimproto waits for output.ready before sending capabilities
+	if (!probe_device) {
+		unsigned max_rate;
+		if (!test_open(output.device, &max_rate)) {
+			LOG_ERROR("unable to open output device");
+			exit(0);
+		}
+		LOCK;
+		output.max_sample_rate = max_rate;
+		UNLOCK;
+	}
+
+	LOG_INFO("output: %s maxrate: %u", output.device, output.max_sample_rate);
+	LOG_INFO("startup: output device probed at %u ms", startup_ms());
+
+#if LINUX
+	// RT linux - aim to avoid pagefaults by locking memory: 
+	// https://rt.wiki.kernel.org/index.php/Threaded_RT-application_with_memory_locking_and_stack_handling_example
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+		LOG_INFO("unable to lock memory: %s", strerror(errno));
+	} else {
+		LOG_INFO("memory locked");
+	}
+
+   	mallopt(M_TRIM_THRESHOLD, -1);
+   	mallopt(M_MMAP_MAX, 0);
+
+	touch_memory(silencebuf, MAX_SILENCE_FRAMES * BYTES_PER_FRAME);
+	touch_memory(outputbuf->buf, outputbuf->size);
+
+	LOG_INFO("startup: output memory prefaulted at %u ms", startup_ms());
+#endif
+
+	LOCK;
+	output.ready = true;
+	UNLOCK;
+
 	while (running) {
 
 		// disabled output - player is off
@@ -570,40 +1396,174 @@ static void *output_thread(void *arg) {
 			if (!running) return 0;
 		}
 
+		// idle - device closed until playback resumes, while stopped or off
+		while (idle) {
+			idle_wait();
+			LOCK;
+			idle = (output.state <= OUTPUT_STOPPED);
+			UNLOCK;
+			if (!running) return 0;
+			if (!idle) LOG_INFO("leaving idle");
+		}
+
+		// idle once stopped, which pause also sets, for the idle time, closing the device so it can suspend rather than
+		// playing silence to it - frames held by a device paused in hardware are moved back to outputbuf to play again
+		// once resumed, it is left open if they can not be
+		if (alsa.idle_ms && pcmp) {
+			LOCK;
+			if (output.state != OUTPUT_STOPPED) {
+				stopped_since = 0;
+			} else if (!stopped_since) {
+				stopped_since = gettime_ms();
+			} else if (gettime_ms() - stopped_since > alsa.idle_ms) {
+				if (!alsa.paused || _alsa_unqueue(pcmp)) {
+					output.device_frames = 0;
+					idle = true;
+				} else {
+					stopped_since = gettime_ms();
+				}
+			}
+			UNLOCK;
+			if (idle) {
+				LOG_INFO("idle - closing device");
+				alsa_unpublish();
+				alsa_close(pcmp);
+				alsa_close_next();
+				pcmp = NULL;
+				stopped_since = 0;
+				continue;
+			}
+		}
+
 		// wait until device returns - to allow usb audio devices to be turned off
 		if (probe_device) {
 			while (!pcm_probe(output.device)) {
 				LOG_DEBUG("waiting for device %s to return", output.device);
-				sleep(5);
+				hotplug_wait(5000);
 			}
 			probe_device = false;
 		}
 
+		if (pcmp && alsa.rate != output.current_sample_rate && alsa.next_pcmp && alsa.next_rate == output.current_sample_rate) {
+			// switch to the pre-opened handle once the outgoing track has finished playing
+			LOG_INFO("switching to pre-opened device at: %u", alsa.next_rate);
+			alsa_unpublish();
+			if ((err = snd_pcm_drain(pcmp)) < 0) {
+				LOG_INFO("snd_pcm_drain error: %s", snd_strerror(err));
+			}
+			alsa_close(pcmp);
+			pcmp = alsa.next_pcmp;
+			alsa.next_pcmp = NULL;
+			alsa.next_rate = 0;
+			if (alsa_apply(&alsa.next) < 0) {
+				alsa_close(pcmp);
+				pcmp = NULL;
+			}
+			start = true;
+		}
+
+		if (pcmp && alsa.reopen) {
+			// reached a track boundary with tuned params, let the outgoing track play out before reopening
+			LOG_INFO("reopening device with tuned params");
+			alsa_unpublish();
+			if ((err = snd_pcm_drain(pcmp)) < 0) {
+				LOG_INFO("snd_pcm_drain error: %s", snd_strerror(err));
+			}
+			alsa_close(pcmp);
+			pcmp = NULL;
+		}
+		alsa.reopen = false;
+
 		if (!pcmp || alsa.rate != output.current_sample_rate) {
 			LOG_INFO("open output device: %s", output.device);
-			if (!!alsa_open(&pcmp, output.device, output.current_sample_rate, output.buffer_time, output.period_count)) {
-				sleep(5);
+			alsa.retune = false;
+			alsa_unpublish();
+			alsa_close_next();
+			struct alsa_params p;
+			p.hw_params = alsa.hw_cache;
+			if (!!alsa_open(&pcmp, &p, output.device, output.current_sample_rate, output.buffer_time, output.period_count, 0) ||
+				alsa_apply(&p) < 0) {
+				alsa.rate = 0;
+				hotplug_wait(5000);
 				continue;
 			}
 			start = true;
+			if (output.strm_received) {
+				LOG_INFO("device open %u ms after strm", gettime_ms() - output.strm_received);
+			}
+		}
+
+		if (preopen_rate) {
+			alsa_close_next();
+			alsa_preopen(preopen_rate);
+			preopen_rate = 0;
+		}
+
+		xrun_tune();
+
+		// device paused in hardware - resume once no longer stopped, frames held in the device then continue exactly
+		if (alsa.paused) {
+			bool paused;
+			s64_t until = 0;
+			LOCK;
+			if (output.state == OUTPUT_START_AT) {
+				until = until_start_at(gettime_us());
+			}
+			if (output.state != OUTPUT_STOPPED && (until <= 0 || until > 10000000)) {
+				_output_pause(false);
+			}
+			paused = alsa.paused;
+			UNLOCK;
+			if (paused) {
+				// frames held by the device play from the instant it resumes, so sleep to the start time if it is near
+				usleep(until > 0 && until < 10000 ? (unsigned)until : 10000);
+				continue;
+			}
+		}
+
+		// the handle is used with the mutex held as the decode thread may write to it direct, other than while waiting
+		LOCK;
+
+		if (alsa.drop) {
+			alsa.drop = false;
+			if ((err = snd_pcm_drop(pcmp)) < 0) {
+				LOG_INFO("snd_pcm_drop error: %s", snd_strerror(err));
+			}
+		}
+
+		if (alsa.rewind_due) {
+			alsa.rewind_due = false;
+			_output_rewind();
 		}
 
 		snd_pcm_state_t state = snd_pcm_state(pcmp);
 
 		if (state == SND_PCM_STATE_XRUN) {
 			LOG_INFO("XRUN");
-			if ((err = snd_pcm_recover(pcmp, -EPIPE, 1)) < 0) {
+			if ((err = alsa_recover(pcmp, -EPIPE)) < 0) {
 				LOG_INFO("XRUN recover failed: %s", snd_strerror(err));
 			}
+			UNLOCK;
+			start = true;
+			continue;
+		} else if (state == SND_PCM_STATE_SETUP) {
+			// stopped by snd_pcm_drop on flush
+			if ((err = snd_pcm_prepare(pcmp)) < 0) {
+				LOG_INFO("prepare error: %s", snd_strerror(err));
+			}
+			UNLOCK;
 			start = true;
 			continue;
 		} else if (state == SND_PCM_STATE_SUSPENDED) {
-			if ((err = snd_pcm_recover(pcmp, -ESTRPIPE, 1)) < 0) {
+			if ((err = alsa_recover(pcmp, -ESTRPIPE)) < 0) {
 				LOG_INFO("SUSPEND recover failed: %s", snd_strerror(err));
 			}
 		} else if (state == SND_PCM_STATE_DISCONNECTED) {
+			UNLOCK;
 			LOG_INFO("Device %s no longer available", output.device);
+			alsa_unpublish();
 			alsa_close(pcmp);
+			alsa_close_next();
 			pcmp = NULL;
 			probe_device = true;
 			continue;
@@ -611,7 +1571,7 @@ static void *output_thread(void *arg) {
 
 		if (start && alsa.mmap) {
 			if ((err = snd_pcm_start(pcmp)) < 0) {
-				if ((err = snd_pcm_recover(pcmp, err, 1)) < 0) {
+				if ((err = alsa_recover(pcmp, err)) < 0) {
 					LOG_INFO("start error: %s", snd_strerror(err));
 				}
 			} else {
@@ -622,10 +1582,14 @@ static void *output_thread(void *arg) {
 		snd_pcm_sframes_t avail = snd_pcm_avail_update(pcmp);
 
 		if (avail < 0) {
-			if ((err = snd_pcm_recover(pcmp, avail, 1)) < 0) {
+			err = alsa_recover(pcmp, avail);
+			UNLOCK;
+			if (err < 0) {
 				if (err == -ENODEV) {
 					LOG_INFO("Device %s no longer available", output.device);
+					alsa_unpublish();
 					alsa_close(pcmp);
+					alsa_close_next();
 					pcmp = NULL;
 					probe_device = true;
 					continue;
@@ -636,14 +1600,25 @@ static void *output_thread(void *arg) {
 			continue;
 		}
 
+		bool woken = false;
+
 		if (avail < alsa.period_size) {
-			if ((err = snd_pcm_wait(pcmp, 1000)) < 0) {
-				if ((err = snd_pcm_recover(pcmp, err, 1)) < 0) {
+			// timer scheduled: sleep until the fill level falls to the margin, drop or pause wake the wait early
+			int timeout = alsa.tsched_ms ? tsched_timeout(pcmp) : 1000;
+			UNLOCK;
+			err = alsa_wait(pcmp, timeout, &woken);
+			LOCK;
+			if (err < 0) {
+				if ((err = alsa_recover(pcmp, err)) < 0) {
 					LOG_INFO("pcm wait error: %s", snd_strerror(err));
 				}
+				UNLOCK;
 				start = true;
 				continue;
 			}
+			if (alsa.tsched_ms && !woken) {
+				tsched_adapt(pcmp, false);
+			}
 			avail = snd_pcm_avail_update(pcmp);
 		}
 
@@ -654,23 +1629,44 @@ static void *output_thread(void *arg) {
 
 		// avoid spinning in cases where wait returns but no bytes available (seen with pulse audio)
 		if (avail == 0) {
-			LOG_SDEBUG("avail 0 - sleeping");
-			usleep(10000);
+			UNLOCK;
+			if (!woken) {
+				LOG_SDEBUG("avail 0 - sleeping");
+				usleep(10000);
+			}
 			continue;
 		}
 
-		LOCK;
-
 		// turn off if requested
 		if (output.state == OUTPUT_OFF) {
+			alsa.pcmp = NULL;
+			alsa.paused = false;
 			UNLOCK;
 			alsa_close(pcmp);
+			alsa_close_next();
 			pcmp = NULL;
 			output_off = true;
 			LOG_INFO("disabling output");
 			continue;
 		}
 
+		// paused by slimproto since the wait returned
+		if (alsa.paused) {
+			UNLOCK;
+			continue;
+		}
+
+		alsa.pcmp = pcmp;
+		output.native_frame_bytes = native_frame_bytes();
+
+		// decoder has queued the start of the next track, pre-open a second handle at its rate once lock is released
+		if (output.track_count && !alsa.single_handle) {
+			unsigned rate = output.tracks[output.track_head].sample_rate;
+			if (rate != alsa.rate && rate != alsa.next_rate) {
+				preopen_rate = rate;
+			}
+		}
+
 #endif // ALSA
 
 #if PORTAUDIO
@@ -683,17 +1679,31 @@ static void *output_thread(void *arg) {
 		frames_t frames, size;
 		bool silence;
 
-		s32_t cross_gain_in = 0, cross_gain_out = 0; s32_t *cross_ptr = NULL;
+		s32_t cross_gain_in = 0, cross_gain_out = 0; bool cross_mix = false; bool cross_alone = false;
 
 #if PORTAUDIO
 		LOCK;
 #endif
 
-		frames = _buf_used(outputbuf) / BYTES_PER_FRAME;
+		// nothing from the previous track remains - switch to the rate of the next track now so the device is opened
+		// while the stream is buffering rather than once the threshold is met and track start is reached, not while off
+		if ((output.state == OUTPUT_STOPPED || output.state == OUTPUT_BUFFER) && output.track_count &&
+			output.tracks[output.track_head].pos == outputbuf->readp &&
+			output.current_sample_rate != output.tracks[output.track_head].sample_rate) {
+			LOG_INFO("early switch to sample rate: %u", output.tracks[output.track_head].sample_rate);
+			output.current_sample_rate = output.tracks[output.track_head].sample_rate;
+			output.frame_bytes = output.tracks[output.track_head].frame_bytes;
+#if ALSA
+			UNLOCK;
+			continue;
+#endif
+		}
+
+		frames = _buf_used(outputbuf) / output.frame_bytes;
 		silence = false;
 
 		// start when threshold met, note: avail * 4 may need tuning
-		if (output.state == OUTPUT_BUFFER && frames > avail * 4 && frames > output.threshold * output.next_sample_rate / 100) {
+		if (output.state == OUTPUT_BUFFER && frames > avail * 4 && _start_ready(frames)) {
 			output.state = OUTPUT_RUNNING;
 			wake_controller();
 		}
@@ -706,9 +1716,9 @@ static void *output_thread(void *arg) {
 				frames -= skip;
 				output.frames_played += skip;
 				while (skip > 0) {
-					frames_t cont_frames = min(skip, _buf_cont_read(outputbuf) / BYTES_PER_FRAME);
+					frames_t cont_frames = min(skip, _buf_cont_read(outputbuf) / output.frame_bytes);
 					skip -= cont_frames;
-					_buf_inc_readp(outputbuf, cont_frames * BYTES_PER_FRAME);
+					_buf_inc_readp(outputbuf, cont_frames * output.frame_bytes);
 				}
 			}
 			output.state = OUTPUT_RUNNING;
@@ -728,15 +1738,42 @@ static void *output_thread(void *arg) {
 		}
 
 		// start at - play slience until jiffies reached
+		// the exact number of frames is written for the first frame of the track to reach the dac at jiffies
 		if (output.state == OUTPUT_START_AT) {
-			u32_t now = gettime_ms();
-			if (now >= output.start_at || output.start_at > now + 10000) {
+			u64_t now_us = gettime_us();
+			s64_t until_us = until_start_at(now_us);
+			s64_t delta_frames = until_us * output.current_sample_rate / 1000000;
+#if ALSA
+			delta_frames -= alsa_queued(pcmp, now_us);
+#endif
+#if PORTAUDIO
+			delta_frames -= (s64_t)((time_info->outputBufferDacTime - Pa_GetStreamTime(pa.stream)) * output.current_sample_rate);
+#endif
+			if (delta_frames <= 0 || until_us > 10000000) {
+				LOG_INFO("start at reached: %d us from jiffies", (int)(delta_frames * 1000000 / output.current_sample_rate));
 				output.state = OUTPUT_RUNNING;
 			} else {
-				u32_t delta_frames = (output.start_at - now) * output.current_sample_rate / 1000;
 				silence = true;
-				frames = min(avail, delta_frames);
-				frames = min(frames, MAX_SILENCE_FRAMES);
+				frames = min(avail, (frames_t)min(delta_frames, MAX_SILENCE_FRAMES));
+			}
+		}
+
+		// crossfading but nothing of the incoming track is buffered yet - play the outgoing tail held in crossbuf alone at
+		// the gain reached so a slow stream does not cut it, the fade does not progress until incoming frames arrive
+		if (output.state == OUTPUT_RUNNING && frames == 0 && output.fade && output.fade_dir == FADE_CROSS &&
+			_buf_used(crossbuf) != 0) {
+			cross_alone = true;
+			frames = _buf_cont_read(crossbuf) / BYTES_PER_FRAME;
+			cross_gain_out = FIXED_ONE;
+			if (output.fade == FADE_ACTIVE) {
+				frames_t cur_f = outputbuf->readp >= output.fade_start ? (outputbuf->readp - output.fade_start) / BYTES_PER_FRAME :
+					(outputbuf->readp + outputbuf->size - output.fade_start) / BYTES_PER_FRAME;
+				frames_t dur_f = output.fade_end >= output.fade_start ? (output.fade_end - output.fade_start) / BYTES_PER_FRAME :
+					(output.fade_end + outputbuf->size - output.fade_start) / BYTES_PER_FRAME;
+				cross_gain_out = dur_f ? FIXED_ONE - to_gain((float)min(cur_f, dur_f) / (float)dur_f) : FIXED_ONE;
+			}
+			if (output.current_replay_gain) {
+				cross_gain_out = gain(cross_gain_out, output.current_replay_gain);
 			}
 		}
 
@@ -746,50 +1783,125 @@ static void *output_thread(void *arg) {
 			frames = min(avail, MAX_SILENCE_FRAMES);
 		}
 
-		LOG_SDEBUG("avail: %d frames: %d silence: %d", avail, frames, silence);
-		frames = min(frames, avail);
-		size = frames;
-
+		LOG_SDEBUG("avail: %d frames: %d silence: %d", avail, frames, silence);
+		frames = min(frames, avail);
+		size = frames;
+
+		output.frames_played_dmp = output.frames_played;
+
+#if ALSA
+		// delay and the time it was measured are taken together from the status, with timestamps enabled this is the
+		// time of the last hardware pointer update which the delay is relative to
+		snd_pcm_sframes_t delay;
+		snd_htimestamp_t ts;
+		if (alsa.status && snd_pcm_status(pcmp, alsa.status) == 0) {
+			delay = snd_pcm_status_get_delay(alsa.status);
+			snd_pcm_status_get_htstamp(alsa.status, &ts);
+		} else {
+			delay = 0;
+			ts.tv_sec = ts.tv_nsec = 0;
+		}
+		output.device_frames = delay > 0 ? delay : 0;
+		if (alsa.htstamp && (ts.tv_sec || ts.tv_nsec) && snd_pcm_status_get_state(alsa.status) == SND_PCM_STATE_RUNNING) {
+			output.updated_us = (u64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		} else {
+			output.updated_us = gettime_us();
+		}
+
+		// decode thread is feeding the device direct, leave the device to it until the stream ends or the device runs
+		// dry rather than adding silence when it falls briefly behind
+		if (alsa.direct_fed && silence && output.state == OUTPUT_RUNNING) {
+			UNLOCK;
+			usleep(alsa.period_size * 500000 / alsa.rate);
+			continue;
+		}
+		alsa.direct_fed = false;
+
+		// timer scheduled: queue at most two margins of silence so playback does not start behind a full buffer of it
+		if (alsa.tsched_ms && silence && output.state != OUTPUT_PAUSE_FRAMES) {
+			snd_pcm_sframes_t limit = (snd_pcm_sframes_t)alsa.tsched_margin_ms * alsa.rate / 500 - delay;
+			if (limit <= 0) {
+				UNLOCK;
+				usleep(alsa.tsched_margin_ms * 1000);
+				continue;
+			}
+			frames = min(frames, (frames_t)limit);
+			size = frames;
+		}
+#endif
+#if PORTAUDIO
+		output.device_frames = (unsigned)((time_info->outputBufferDacTime - Pa_GetStreamTime(pa.stream)) * output.current_sample_rate);
+		output.updated_us = gettime_us();
+#endif
+
+		if (output.drift) {
+			u64_t now_us = gettime_us();
 #if ALSA
-		snd_pcm_sframes_t delay;
-		snd_pcm_delay(pcmp, &delay);
-		output.device_frames = delay;
+			_drift_update(now_us, alsa_queued(pcmp, now_us));
 #endif
 #if PORTAUDIO
-		output.device_frames = (unsigned)((time_info->outputBufferDacTime - Pa_GetStreamTime(pa.stream)) * output.current_sample_rate);
+			_drift_update(now_us, output.device_frames);
 #endif
-		output.updated = gettime_ms();
+		}
 
 		while (size > 0) {
 			frames_t out_frames;
 			
-			frames_t cont_frames = _buf_cont_read(outputbuf) / BYTES_PER_FRAME;
+			frames_t cont_frames = _buf_cont_read(outputbuf) / output.frame_bytes;
 
 			s32_t gainL = output.current_replay_gain ? gain(output.gainL, output.current_replay_gain) : output.gainL;
 			s32_t gainR = output.current_replay_gain ? gain(output.gainR, output.current_replay_gain) : output.gainR;
+
+			// written from crossbuf, readp stays at the incoming track so neither its start nor the fade are reached
+			u8_t *readp = cross_alone ? crossbuf->readp : outputbuf->readp;
+			if (cross_alone) {
+				cont_frames = _buf_cont_read(crossbuf) / BYTES_PER_FRAME;
+				gainL = gain(output.gainL, cross_gain_out);
+				gainR = gain(output.gainR, cross_gain_out);
+			}
 			
-			if (output.track_start && !silence) {
-				if (output.track_start == outputbuf->readp) {
-					LOG_INFO("track start sample rate: %u replay_gain: %u", output.next_sample_rate, output.next_replay_gain);
+			if (output.track_count && !silence && !cross_alone) {
+				struct trackstart *next = &output.tracks[output.track_head];
+				if (next->pos == outputbuf->readp) {
+					LOG_INFO("track start sample rate: %u replay_gain: %u fade mode: %u duration: %u queued: %u",
+							 next->sample_rate, next->replay_gain, next->fade_mode, next->fade_secs, output.track_count - 1);
+					if (output.strm_received) {
+						LOG_INFO("start latency: %u ms from strm to first sample written", gettime_ms() - output.strm_received);
+						output.strm_received = 0;
+					}
 					output.frames_played = 0;
 					output.track_started = true;
-					output.current_sample_rate = output.next_sample_rate;
-					if (!output.fade == FADE_ACTIVE || !output.fade_mode == FADE_CROSSFADE) {
-						output.current_replay_gain = output.next_replay_gain;
+					wake_controller();
+#if ALSA
+					alsa.rewind_frames = 0;
+#endif
+					if (output.fade != FADE_DUE || output.fade_dir != FADE_CROSS) {
+						output.current_replay_gain = next->replay_gain;
+					} else {
+						output.cross_replay_gain = next->replay_gain;
+					}
+					output.track_head = (output.track_head + 1) % TRACK_STARTS;
+					output.track_count--;
+					output.frame_bytes = next->frame_bytes;
+					if (output.current_sample_rate != next->sample_rate) {
+						// stop at the boundary so no frames of the new track are written to the device at the old rate
+						output.current_sample_rate = next->sample_rate;
+						break;
 					}
-					output.track_start = NULL;
-					if (output.current_sample_rate != output.next_sample_rate) {
-						output.current_sample_rate = output.next_sample_rate;
+#if ALSA
+					if (alsa.retune) {
+						alsa.reopen = true;
 						break;
 					}
+#endif
 					continue;
-				} else if (output.track_start > outputbuf->readp) {
+				} else if (next->pos > outputbuf->readp) {
 					// reduce cont_frames so we find the next track start at beginning of next chunk
-					cont_frames = min(cont_frames, (output.track_start - outputbuf->readp) / BYTES_PER_FRAME);
+					cont_frames = min(cont_frames, (next->pos - outputbuf->readp) / output.frame_bytes);
 				}
 			}
 
-			if (output.fade && !silence) {
+			if (output.fade && !silence && !cross_alone) {
 				if (output.fade == FADE_DUE) {
 					if (output.fade_start == outputbuf->readp) {
 						LOG_INFO("fade start reached");
@@ -804,6 +1916,10 @@ static void *output_thread(void *arg) {
 						(outputbuf->readp + outputbuf->size - output.fade_start) / BYTES_PER_FRAME;
 					frames_t dur_f = output.fade_end >= output.fade_start ? (output.fade_end - output.fade_start) / BYTES_PER_FRAME :
 						(output.fade_end + outputbuf->size - output.fade_start) / BYTES_PER_FRAME;
+					if (output.fade_dir == FADE_CROSS && _buf_used(crossbuf) == 0 && cur_f < dur_f) {
+						LOG_INFO("outgoing track exhausted before end of crossfade");
+						cur_f = dur_f;
+					}
 					if (cur_f >= dur_f) {
 						if (output.fade_mode == FADE_INOUT && output.fade_dir == FADE_DOWN) {
 							LOG_INFO("fade down complete, starting fade up");
@@ -814,16 +1930,11 @@ static void *output_thread(void *arg) {
 								output.fade_end -= outputbuf->size;
 							}
 							cur_f = 0;
-						} else if (output.fade_mode == FADE_CROSSFADE) {
+						} else if (output.fade_dir == FADE_CROSS) {
 							LOG_INFO("crossfade complete");
-							if (_buf_used(outputbuf) >= dur_f * BYTES_PER_FRAME) {
-								_buf_inc_readp(outputbuf, dur_f * BYTES_PER_FRAME);
-								LOG_INFO("skipped crossfaded start");
-							} else {
-								LOG_WARN("unable to skip crossfaded start");
-							}
+							crossbuf->readp = crossbuf->writep = crossbuf->buf;
 							output.fade = FADE_INACTIVE;
-							output.current_replay_gain = output.next_replay_gain;
+							output.current_replay_gain = output.cross_replay_gain;
 						} else {
 							LOG_INFO("fade complete");
 							output.fade = FADE_INACTIVE;
@@ -845,24 +1956,20 @@ static void *output_thread(void *arg) {
 							gainR = gain(gainR, fade_gain);
 						}
 						if (output.fade_dir == FADE_CROSS) {
-							// cross fade requires special treatment - performed later based on these values
+							// cross fade mixes the outgoing track held in crossbuf with the incoming track at readp
 							// support different replay gain for old and new track by retaining old value until crossfade completes
-							if (_buf_used(outputbuf) / BYTES_PER_FRAME > dur_f + size) { 
-								cross_gain_in  = to_gain((float)cur_f / (float)dur_f);
-								cross_gain_out = FIXED_ONE - cross_gain_in;
-								if (output.current_replay_gain) {
-									cross_gain_out = gain(cross_gain_out, output.current_replay_gain);
-								}
-								if (output.next_replay_gain) {
-									cross_gain_in = gain(cross_gain_in, output.next_replay_gain);
-								}
-								gainL = output.gainL;
-								gainR = output.gainR;
-								cross_ptr = (s32_t *)(output.fade_end + cur_f * BYTES_PER_FRAME);
-							} else {
-								LOG_INFO("unable to continue crossfade - too few samples");
-								output.fade = FADE_INACTIVE;
+							cont_frames = min(cont_frames, _buf_cont_read(crossbuf) / BYTES_PER_FRAME);
+							cross_gain_in  = to_gain((float)cur_f / (float)dur_f);
+							cross_gain_out = FIXED_ONE - cross_gain_in;
+							if (output.current_replay_gain) {
+								cross_gain_out = gain(cross_gain_out, output.current_replay_gain);
+							}
+							if (output.cross_replay_gain) {
+								cross_gain_in = gain(cross_gain_in, output.cross_replay_gain);
 							}
+							gainL = output.gainL;
+							gainR = output.gainR;
+							cross_mix = true;
 						}
 					}
 				}
@@ -871,14 +1978,17 @@ static void *output_thread(void *arg) {
  			out_frames = !silence ? min(size, cont_frames) : size;
 
 #if ALSA			
-			if (alsa.mmap || alsa.format != NATIVE_FORMAT) {
+			if (output.frame_bytes != BYTES_PER_FRAME) {
 
-				// in all alsa cases except NATIVE_FORMAT non mmap we take this path:
-				// - mmap: scale and pack to output format, write direct into mmap region
-				// - non mmap: scale and pack into alsa.write_buf, which is the used with writei to send to alsa
+				// outputbuf holds frames packed in the device format by the process stage, only gain needs applying:
+				// - mmap: copy or scale direct into mmap region
+				// - non mmap: writei direct from outputbuf, or scale into alsa.write_buf if gain is not unity
 				const snd_pcm_channel_area_t *areas;
 				snd_pcm_uframes_t offset;
 				snd_pcm_uframes_t alsa_frames = (snd_pcm_uframes_t)out_frames;
+				u8_t *inputptr = silence ? silencebuf : readp;
+				u8_t *outputptr = NULL;
+				bool unity = silence || (gainL == FIXED_ONE && gainR == FIXED_ONE);
 
 				if (alsa.mmap) {
 
@@ -888,23 +1998,72 @@ static void *output_thread(void *arg) {
 					}
 
 					out_frames = (frames_t)alsa_frames;
+					outputptr = areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+
+				} else if (!unity) {
+					outputptr = alsa.write_buf;
+				}
+
+				if (outputptr && unity) {
+					memcpy(outputptr, inputptr, out_frames * output.frame_bytes);
+				} else if (outputptr) {
+					gain_native(outputptr, inputptr, out_frames, gainL, gainR);
 				}
 
-				// perform crossfade buffer copying here as we do not know the actual out_frames value until here
-				if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && cross_ptr) {
-					s32_t *ptr = (s32_t *)(void *)outputbuf->readp;
-					frames_t count = out_frames * 2;
-					while (count--) {
-						if (cross_ptr > (s32_t *)outputbuf->wrap) {
-							cross_ptr -= outputbuf->size / BYTES_PER_FRAME * 2;
+				if (alsa.mmap) {
+					snd_pcm_sframes_t w = snd_pcm_mmap_commit(pcmp, offset, out_frames);
+					if (w < 0 || w != out_frames) {
+						LOG_WARN("mmap_commit error");
+						break;
+					}
+				} else {
+					snd_pcm_sframes_t w = snd_pcm_writei(pcmp, outputptr ? outputptr : inputptr, out_frames);
+					if (w < 0) {
+						if (w != -EAGAIN && ((err = alsa_recover(pcmp, w)) < 0)) {
+							static unsigned recover_count = 0;
+							LOG_WARN("recover failed: %s [%u]", snd_strerror(err), ++recover_count);
+							if (recover_count >= 10) {				
+								recover_count = 0;
+								alsa.pcmp = NULL;
+								alsa_close(pcmp);
+								pcmp = NULL;
+							}
 						}
-						*ptr = gain(cross_gain_out, *ptr) + gain(cross_gain_in, *cross_ptr);
-						ptr++; cross_ptr++;
+						break;
+					} else {
+						if (w != out_frames) {
+							LOG_WARN("writei only wrote %u of %u", w, out_frames);
+						}						
+						out_frames = w;
+					}
+				}
+
+			} else if (alsa.mmap || alsa.format != NATIVE_FORMAT || alsa.rewind) {
+
+				// in all alsa cases except NATIVE_FORMAT non mmap without rewind we take this path:
+				// - mmap: scale and pack to output format, write direct into mmap region
+				// - non mmap: scale and pack into alsa.write_buf, which is the used with writei to send to alsa
+				const snd_pcm_channel_area_t *areas;
+				snd_pcm_uframes_t offset;
+				snd_pcm_uframes_t alsa_frames = (snd_pcm_uframes_t)out_frames;
+
+				if (alsa.mmap) {
+
+					if ((err = snd_pcm_mmap_begin(pcmp, &areas, &offset, &alsa_frames)) < 0) {
+						LOG_WARN("error from mmap_begin: %s", snd_strerror(err));
+						break;
 					}
+
+					out_frames = (frames_t)alsa_frames;
+				}
+
+				// perform crossfade mixing here as we do not know the actual out_frames value until here
+				if (cross_mix) {
+					_crossfade_mix(out_frames, cross_gain_in, cross_gain_out);
 				}
 
 				void  *outputptr = alsa.mmap ? (areas[0].addr + (areas[0].first + offset * areas[0].step) / 8) : alsa.write_buf;
-				s32_t *inputptr  = (s32_t *) (silence ? silencebuf : outputbuf->readp);
+				s32_t *inputptr  = (s32_t *) (silence ? silencebuf : readp);
 				frames_t cnt = out_frames;
 				
 				switch(alsa.format) {
@@ -1112,11 +2271,12 @@ static void *output_thread(void *arg) {
 				} else {
 					snd_pcm_sframes_t w = snd_pcm_writei(pcmp, alsa.write_buf, out_frames);
 					if (w < 0) {
-						if (w != -EAGAIN && ((err = snd_pcm_recover(pcmp, w, 1)) < 0)) {
+						if (w != -EAGAIN && ((err = alsa_recover(pcmp, w)) < 0)) {
 							static unsigned recover_count = 0;
 							LOG_WARN("recover failed: %s [%u]", snd_strerror(err), ++recover_count);
 							if (recover_count >= 10) {				
 								recover_count = 0;
+								alsa.pcmp = NULL;
 								alsa_close(pcmp);
 								pcmp = NULL;
 							}
@@ -1139,22 +2299,14 @@ static void *output_thread(void *arg) {
 #endif
 				if (!silence) {
 
-					if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && cross_ptr) {
-						s32_t *ptr = (s32_t *)(void *)outputbuf->readp;
-						frames_t count = out_frames * 2;
-						while (count--) {
-							if (cross_ptr > (s32_t *)outputbuf->wrap) {
-								cross_ptr -= outputbuf->size / BYTES_PER_FRAME * 2;
-							}
-							*ptr = gain(cross_gain_out, *ptr) + gain(cross_gain_in, *cross_ptr);
-							ptr++; cross_ptr++;
-						}
+					if (cross_mix) {
+						_crossfade_mix(out_frames, cross_gain_in, cross_gain_out);
 					}
 
 					if (gainL != FIXED_ONE || gainR!= FIXED_ONE) {
 						unsigned count = out_frames;
-						s32_t *ptrL = (s32_t *)(void *)outputbuf->readp;
-						s32_t *ptrR = (s32_t *)(void *)outputbuf->readp + 1;
+						s32_t *ptrL = (s32_t *)(void *)readp;
+						s32_t *ptrR = (s32_t *)(void *)readp + 1;
 						while (count--) {
 							*ptrL = gain(gainL, *ptrL);
 							*ptrR = gain(gainR, *ptrR);
@@ -1164,14 +2316,16 @@ static void *output_thread(void *arg) {
 					}
 				}
 #if ALSA
-				// only used in S32_LE non mmap LE case, write the 32 samples straight with writei, no need for intermediate buffer
-				snd_pcm_sframes_t w = snd_pcm_writei(pcmp, silence ? silencebuf : outputbuf->readp, out_frames);
+				// only used in S32_LE non mmap LE case without rewind, write the 32 samples straight with writei, no need for
+				// intermediate buffer, gain is applied in place so these frames can not be re-rendered
+				snd_pcm_sframes_t w = snd_pcm_writei(pcmp, silence ? silencebuf : readp, out_frames);
 				if (w < 0) {
-					if (w != -EAGAIN && ((err = snd_pcm_recover(pcmp, w, 1)) < 0)) {
+					if (w != -EAGAIN && ((err = alsa_recover(pcmp, w)) < 0)) {
 						static unsigned recover_count = 0;
 						LOG_WARN("recover failed: %s [%u]", snd_strerror(err), ++recover_count);
 						if (recover_count >= 10) {				
 							recover_count = 0;
+							alsa.pcmp = NULL;
 							alsa_close(pcmp);
 							pcmp = NULL;
 						}
@@ -1186,7 +2340,7 @@ static void *output_thread(void *arg) {
 #endif
 #if PORTAUDIO
 				if (!silence) {
-					memcpy(optr, outputbuf->readp, out_frames * BYTES_PER_FRAME);
+					memcpy(optr, readp, out_frames * BYTES_PER_FRAME);
 				} else {
 					memset(optr, 0, out_frames * BYTES_PER_FRAME);
 				}
@@ -1197,14 +2351,26 @@ static void *output_thread(void *arg) {
 
 			size -= out_frames;
 			
-			if (!silence) {
-				_buf_inc_readp(outputbuf, out_frames * BYTES_PER_FRAME);
-				output.frames_played += out_frames;
+			if (cross_alone) {
+				_buf_inc_readp(crossbuf, out_frames * BYTES_PER_FRAME);
+				output.frames_played += _drift_played(out_frames);
+			} else if (!silence) {
+				_buf_inc_readp(outputbuf, out_frames * output.frame_bytes);
+				output.frames_played += _drift_played(out_frames);
 			}
+
+#if ALSA
+			// frames written from outputbuf since the last silence, track start or fade can be re-rendered
+			alsa.rewind_frames = !silence && !output.fade ? alsa.rewind_frames + out_frames : 0;
+#endif
 		}
 			
 		LOG_SDEBUG("wrote %u frames", frames);
 
+		drift.written += frames - size;
+
+		_output_publish();
+
 #if ALSA	
 		UNLOCK;
 	}
@@ -1214,9 +2380,10 @@ static void *output_thread(void *arg) {
 #endif
 
 #if PORTAUDIO
-		if (frames < pa_frames_wanted) {
+		// frames - size have been written, size remains if stopped early at a sample rate change
+		if (frames - size < pa_frames_wanted) {
 			LOG_SDEBUG("pad with silence");
-	   		memset(optr, 0, (pa_frames_wanted - frames) * BYTES_PER_FRAME);
+	   		memset(optr, 0, (pa_frames_wanted - frames + size) * BYTES_PER_FRAME);
 		}
 
 		if (pa.rate != output.current_sample_rate) {
@@ -1234,6 +2401,12 @@ void _checkfade(bool start) {
 
 	LOG_INFO("fade mode: %u duration: %u %s", output.fade_mode, output.fade_secs, start ? "track-start" : "track-end");
 
+	// fades are applied to 32 bit frames, not those already packed in device format
+	if (output.next_frame_bytes != BYTES_PER_FRAME || (start && output.tail_frame_bytes != BYTES_PER_FRAME)) {
+		LOG_INFO("fade disabled for frames in device format");
+		return;
+	}
+
 	bytes = output.next_sample_rate * BYTES_PER_FRAME * output.fade_secs;
 	if (output.fade_mode == FADE_INOUT) {
 		bytes /= 2;
@@ -1265,28 +2438,53 @@ void _checkfade(bool start) {
 
 	if (start && output.fade_mode == FADE_CROSSFADE) {
 		if (_buf_used(outputbuf) != 0) {
+			u8_t *tail;
+			size_t cont;
 			if (output.next_sample_rate != output.current_sample_rate) {
 				LOG_INFO("crossfade disabled as sample rates differ");
 				return;
 			}
+			if (_buf_used(crossbuf) != 0) {
+				LOG_INFO("crossfade disabled as previous crossfade still active");
+				return;
+			}
 			bytes = min(bytes, _buf_used(outputbuf));               // max of current remaining samples from previous track
-			bytes = min(bytes, (frames_t)(outputbuf->size * 0.9));  // max of 90% of outputbuf as we consume additional buffer during crossfade
+			if (output.track_count > 1) {
+				// the previous track has not started playing, it may be shorter than the crossfade
+				u8_t *prev = output.tracks[(output.track_head + output.track_count - 2) % TRACK_STARTS].pos;
+				bytes = min(bytes, (frames_t)(outputbuf->writep >= prev ? outputbuf->writep - prev :
+											  outputbuf->writep + outputbuf->size - prev));
+			}
+			// crossbuf is sized by output_crossbuf_prepare before the stream starts, shorten the crossfade to fit it
+			if (crossbuf->size <= BYTES_PER_FRAME) {
+				LOG_WARN("no crossbuf - crossfade disabled");
+				return;
+			}
+			if (crossbuf->size <= bytes) {
+				LOG_INFO("crossfade shortened to crossbuf: %u", (unsigned)(crossbuf->size - BYTES_PER_FRAME));
+				bytes = crossbuf->size - BYTES_PER_FRAME;
+			}
+			// move the tail of the outgoing track into crossbuf, the incoming track is then written from where the tail began
+			// and the two are mixed by the output thread, so outputbuf never needs to hold the overlapping region twice
+			tail = outputbuf->writep - bytes;
+			if (tail < outputbuf->buf) {
+				tail += outputbuf->size;
+			}
+			crossbuf->readp = crossbuf->writep = crossbuf->buf;
+			cont = min(bytes, outputbuf->wrap - tail);
+			memcpy(crossbuf->writep, tail, cont);
+			memcpy(crossbuf->writep + cont, outputbuf->buf, bytes - cont);
+			_buf_inc_writep(crossbuf, bytes);
+			outputbuf->writep = tail;
 			LOG_INFO("CROSSFADE: %u frames", bytes / BYTES_PER_FRAME);
 			output.fade = FADE_DUE;
 			output.fade_dir = FADE_CROSS;
-			output.fade_start = outputbuf->writep - bytes;
-			if (output.fade_start < outputbuf->buf) {
-				output.fade_start += outputbuf->size;
+			output.fade_start = outputbuf->writep;
+			output.fade_end = output.fade_start + bytes;
+			if (output.fade_end >= outputbuf->wrap) {
+				output.fade_end -= outputbuf->size;
 			}
-			output.fade_end = outputbuf->writep;
-			output.track_start = output.fade_start;
-		} else if (outputbuf->size == OUTPUTBUF_SIZE && outputbuf->readp == outputbuf->buf) {
-			// if default setting used and nothing in buffer attempt to resize to provide full crossfade support
-			LOG_INFO("resize outputbuf for crossfade");
-			_buf_resize(outputbuf, OUTPUTBUF_SIZE_CROSSFADE);
-#if LINUX
-			touch_memory(outputbuf->buf, outputbuf->size);
-#endif			
+			output.tracks[(output.track_head + output.track_count - 1) % TRACK_STARTS].pos = output.fade_start;
 		}
 	}
 }
@@ -1294,7 +2492,9 @@ void _checkfade(bool start) {
 #if ALSA
 static pthread_t thread;
 void output_init(log_level level, const char *device, unsigned output_buf_size, unsigned buffer_time, unsigned period_count,
-				 const char *alsa_sample_fmt, bool mmap, unsigned max_rate, unsigned rt_priority) {
+				 const char *alsa_sample_fmt, bool mmap, bool rewind, unsigned native, const char *mixer_ctl, unsigned tsched_ms, unsigned tune_max_ms, unsigned idle_secs,
+				 unsigned max_rate,
+				 unsigned rt_priority) {
 #endif
 #if PORTAUDIO
 void output_init(log_level level, const char *device, unsigned output_buf_size, unsigned latency, unsigned max_rate) {
@@ -1304,7 +2504,8 @@ void output_init(log_level level, const char *device, unsigned output_buf_size,
 
 	LOG_INFO("init output");
 
-	output_buf_size = output_buf_size - (output_buf_size % BYTES_PER_FRAME);
+	// multiple of 24 bytes so groups of frames packed in device format never straddle the wrap
+	output_buf_size = output_buf_size - (output_buf_size % (BYTES_PER_FRAME * 3));
 	LOG_DEBUG("outputbuf size: %u", output_buf_size);
 
 	buf_init(outputbuf, output_buf_size);
@@ -1313,17 +2514,56 @@ void output_init(log_level level, const char *device, unsigned output_buf_size,
 		exit(0);
 	}
 
+	// crossbuf is sized by output_crossbuf_prepare once a stream sets a crossfade
+	buf_init(crossbuf, 0);
+
 	LOCK;
 
 	output.state = OUTPUT_STOPPED;
 	output.current_sample_rate = 44100;
 	output.device = device;
 	output.fade = FADE_INACTIVE;
+	output.frame_bytes = output.next_frame_bytes = output.tail_frame_bytes = BYTES_PER_FRAME;
+	output.native_frame_bytes = 0;
 
 #if ALSA
 	alsa.mmap = mmap;
+	alsa.rewind = rewind;
+	alsa.rewind_frames = 0;
+	alsa.native = native > 0;
+	alsa.direct = native > 1;
+	alsa.direct_fed = false;
 	alsa.write_buf = NULL;
+	alsa.write_buf_frames = 0;
 	alsa.format = 0;
+	alsa.next_pcmp = NULL;
+	alsa.next_rate = 0;
+	alsa.single_handle = false;
+	alsa.pcmp = NULL;
+	alsa.paused = false;
+	alsa.drop = false;
+	alsa.tsched_ms = alsa.tsched_margin_ms = tsched_ms;
+	alsa.tsched_ontime = 0;
+	alsa.tune_max_time = tune_max_ms ? max(tune_max_ms * 1000, buffer_time) : 0;
+	alsa.tune_buffer_time = buffer_time;
+	alsa.tune_period_count = period_count;
+	alsa.xruns = alsa.clean_intervals = 0;
+	alsa.xrun_interval_start = gettime_ms();
+	alsa.retune = alsa.reopen = false;
+	alsa.idle_ms = idle_secs * 1000;
+	if (snd_pcm_status_malloc(&alsa.status) < 0) {
+		alsa.status = NULL;
+	}
+	alsa.hw_cache = alsa.next.hw_params = NULL;
+	wake_create(alsa.wake_e);
+	if (alsa.idle_ms) {
+		// the pre-opened handle negotiates into its own copy, cached once it is swapped in
+		if (snd_pcm_hw_params_malloc(&alsa.hw_cache) < 0 || snd_pcm_hw_params_malloc(&alsa.next.hw_params) < 0) {
+			if (alsa.hw_cache) snd_pcm_hw_params_free(alsa.hw_cache);
+			alsa.hw_cache = alsa.next.hw_params = NULL;
+		}
+	}
+	output.xruns = output.xrun_rate = 0;
 	output.buffer_time = buffer_time;
 	output.period_count = period_count;
 
@@ -1336,10 +2576,17 @@ void output_init(log_level level, const char *device, unsigned output_buf_size,
 		if (!strcmp(alsa_sample_fmt, "16")) alsa.format = SND_PCM_FORMAT_S16_LE;
 	}
 
-	LOG_INFO("requested buffer_time: %u period_count: %u format: %s mmap: %u", output.buffer_time, output.period_count, 
-			 alsa_sample_fmt ? alsa_sample_fmt : "any", alsa.mmap);
+	LOG_INFO("requested buffer_time: %u period_count: %u format: %s mmap: %u rewind: %u native: %u direct: %u",
+			 output.buffer_time, output.period_count, alsa_sample_fmt ? alsa_sample_fmt : "any", alsa.mmap, alsa.rewind,
+			 alsa.native, alsa.direct);
 
 	snd_lib_error_set_handler((snd_lib_error_handler_t)alsa_error_handler);
+
+	alsa.mixer = NULL;
+	alsa.mixer_elem = NULL;
+	if (mixer_ctl) {
+		mixer_init(device, mixer_ctl);
+	}
 #endif
 
 #if PORTAUDIO
@@ -1354,36 +2601,24 @@ void output_init(log_level level, const char *device, unsigned output_buf_size,
 	}
 #endif
 
+	output.ready = false;
+	output.max_sample_rate = max_rate;
+
+#if PORTAUDIO
 	if (!max_rate) {
 		if (!test_open(output.device, &output.max_sample_rate)) {
 			LOG_ERROR("unable to open output device");
 			exit(0);
 		}
-	} else {
-		output.max_sample_rate = max_rate;
 	}
 
 	LOG_INFO("output: %s maxrate: %u", output.device, output.max_sample_rate);
 
-#if ALSA
-
-#if LINUX
-	// RT linux - aim to avoid pagefaults by locking memory: 
-	// https://rt.wiki.kernel.org/index.php/Threaded_RT-application_with_memory_locking_and_stack_handling_example
-	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
-		LOG_INFO("unable to lock memory: %s", strerror(errno));
-	} else {
-		LOG_INFO("memory locked");
-	}
-
-   	mallopt(M_TRIM_THRESHOLD, -1);
-   	mallopt(M_MMAP_MAX, 0);
-
-	touch_memory(silencebuf, MAX_SILENCE_FRAMES * BYTES_PER_FRAME);
-	touch_memory(outputbuf->buf, outputbuf->size);
+	output.ready = true;
 #endif
 
-	// start output thread
+#if ALSA
+	// start output thread, which probes the device if max_rate is not given
 	pthread_attr_t attr;
 	pthread_attr_init(&attr);
 	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + OUTPUT_THREAD_STACK_SIZE);
@@ -1407,14 +2642,329 @@ void output_init(log_level level, const char *device, unsigned output_buf_size,
 	UNLOCK;
 }
 
+// called with mutex locked, pause or resume the device in hardware so frames queued in it stop immediately
+// and are retained for a frame exact resume; without hardware support the device plays out its queued frames
+void _output_pause(bool pause) {
+#if ALSA
+	int err;
+	if (alsa.pcmp && alsa.can_pause && alsa.paused != pause) {
+		if ((err = snd_pcm_pause(alsa.pcmp, pause)) < 0) {
+			LOG_INFO("snd_pcm_pause error: %s", snd_strerror(err));
+		} else {
+			LOG_INFO("device %s", pause ? "paused" : "resumed");
+			alsa.paused = pause;
+		}
+	}
+#endif
+}
+
+// set volume from audg, driving the hardware mixer when configured so digital gain stays at FIXED_ONE for the
+// range it covers, only attenuation beyond the mixer's range or balance between channels is applied digitally
+void output_volume(u32_t gainL, u32_t gainR) {
+#if ALSA
+	if (alsa.mixer_elem) {
+		long target = gain_to_cdb(max(gainL, gainR));
+		long set = max(min(target, min(alsa.mixer_max, 0)), alsa.mixer_min);
+		long actual;
+		int err;
+
+		if ((err = snd_mixer_selem_set_playback_dB_all(alsa.mixer_elem, set, 1)) < 0 ||
+			(err = snd_mixer_selem_get_playback_dB(alsa.mixer_elem, SND_MIXER_SCHN_FRONT_LEFT, &actual)) < 0) {
+			LOG_WARN("mixer set error: %s", snd_strerror(err));
+			actual = 0;
+		}
+
+		LOG_DEBUG("mixer target: %ld set: %ld centi dB", target, actual);
+
+		gainL = residual_gain(gainL, actual);
+		gainR = residual_gain(gainR, actual);
+	}
+#endif
+
+	LOCK;
+	output.gainL = gainL;
+	output.gainR = gainR;
+#if ALSA
+	alsa.rewind_due = alsa.rewind;
+#endif
+	UNLOCK;
+	output_wake();
+}
+
+// called with mutex locked by codecs at the start of each stream, queues its start at writep with what the output thread
+// switches to there, behind the starts of earlier tracks still in outputbuf - returns false if the queue is full, which
+// the decode thread prevents by not starting a stream until a start is popped
+bool _output_track_start(void) {
+	struct trackstart *t;
+
+	if (output.track_count == TRACK_STARTS) {
+		LOG_ERROR("track start queue full - not starting stream");
+		return false;
+	}
+
+	t = &output.tracks[(output.track_head + output.track_count++) % TRACK_STARTS];
+	t->pos = outputbuf->writep;
+	t->sample_rate = output.next_sample_rate;
+	t->frame_bytes = output.next_frame_bytes;
+	t->replay_gain = output.next_replay_gain;
+	t->fade_mode = output.fade_mode;
+	t->fade_secs = output.fade_secs;
+
+	LOG_DEBUG("queued track start: %u sample rate: %u", output.track_count, t->sample_rate);
+
+	return true;
+}
+
+// called by slimproto without the mutex locked before a stream sets its fade mode, sizes crossbuf for the longest crossfade
+// it allows at any rate so _checkfade does not allocate and touch memory with the mutex held at the crossfade start,
+// crossbuf is only replaced while it holds no outgoing track
+void output_crossbuf_prepare(fade_mode mode, unsigned secs) {
+	size_t room = decode_buffer_room();
+	size_t size = 0, cur;
+	u8_t *buf = NULL;
+
+	LOCK;
+	// the crossfade never exceeds outputbuf as the outgoing track is moved from it
+	if (mode == FADE_CROSSFADE) {
+		size = min((size_t)output.max_sample_rate * BYTES_PER_FRAME * secs, outputbuf->size) + BYTES_PER_FRAME;
+	}
+	// reserved against the cap so buffers resized for later tracks leave room for it, meanwhile it gets what is left
+	output.cross_size = size;
+	cur = crossbuf->size;
+	UNLOCK;
+
+	// what is left includes the current crossbuf, which is freed once replaced
+	size = min(size, room);
+	size -= size % BYTES_PER_FRAME;
+	if (size <= BYTES_PER_FRAME) {
+		size = 0;
+	}
+
+	if (size == cur || (size && !(buf = malloc(size)))) {
+		return;
+	}
+#if LINUX
+	if (buf) {
+		touch_memory(buf, size);
+	}
+#endif
+
+	LOCK;
+	if (crossbuf->size == cur && _buf_used(crossbuf) == 0) {
+		u8_t *old = crossbuf->buf;
+		crossbuf->buf = crossbuf->readp = crossbuf->writep = buf;
+		crossbuf->wrap = buf + size;
+		crossbuf->size = crossbuf->base_size = size;
+		buf = old;
+		LOG_INFO("crossbuf size: %u", (unsigned)size);
+	}
+	UNLOCK;
+
+	free(buf);
+}
+
+// called by the decode thread without the mutex locked to resize outputbuf retaining the frames of earlier tracks and
+// the positions of their queued track starts and a fade, the new allocation is made and filled without the mutex so
+// the output thread is not held up, it is only locked to copy frames written since and switch to it
+bool output_resize(size_t size) {
+	struct bufresize r;
+	u8_t **ptrs[TRACK_STARTS + 2];
+	unsigned count = 0;
+	size_t played = 0;
+	unsigned i;
+	bool ok = true;
+
+	size -= size % (BYTES_PER_FRAME * 3);
+
+	if (size == outputbuf->size) {
+		return false;
+	}
+
+	if (!buf_resize_prepare(outputbuf, &r, size, BYTES_PER_FRAME * 3)) {
+		LOG_WARN("unable to resize outputbuf: %u", (unsigned)size);
+		return false;
+	}
+
+	LOCK;
+
+	for (i = 0; i < output.track_count; ++i) {
+		ptrs[count++] = &output.tracks[(output.track_head + i) % TRACK_STARTS].pos;
+	}
+
+	if (output.fade == FADE_DUE) {
+		ptrs[count++] = &output.fade_start;
+		ptrs[count++] = &output.fade_end;
+	}
+
+	// the start of a running fade has been played, it is placed as far behind readp once resized
+	if (output.fade == FADE_ACTIVE) {
+		played = outputbuf->readp >= output.fade_start ? outputbuf->readp - output.fade_start :
+			outputbuf->readp + outputbuf->size - output.fade_start;
+		ptrs[count++] = &output.fade_end;
+		if (played + (output.fade_end >= outputbuf->readp ? output.fade_end - outputbuf->readp :
+					  output.fade_end + outputbuf->size - outputbuf->readp) >= size) {
+			LOG_INFO("outputbuf not resized during fade longer than: %u", (unsigned)size);
+			ok = false;
+		}
+	}
+
+	if (ok && !(ok = _buf_resize_commit(outputbuf, &r, ptrs, count))) {
+		LOG_WARN("unable to resize outputbuf: %u used: %u", (unsigned)size, _buf_used(outputbuf));
+	}
+
+	if (ok && output.fade == FADE_ACTIVE) {
+		output.fade_start = outputbuf->readp - played;
+		if (output.fade_start < outputbuf->buf) {
+			output.fade_start += outputbuf->size;
+		}
+	}
+
+#if ALSA
+	// frames consumed before readp are not retained to be rewound
+	if (ok) {
+		alsa.rewind_frames = 0;
+	}
+#endif
+
+	UNLOCK;
+
+	free(r.buf);
+
+	if (ok) {
+		LOG_INFO("outputbuf resized: %u", (unsigned)size);
+	}
+
+	return ok;
+}
+
+// called by output thread with mutex locked after a volume change, rewinds the device close to the hardware pointer and moves outputbuf
+// readp back by the same amount so the rewound frames are written again with the new gain
+void _output_rewind(void) {
+#if ALSA
+	snd_pcm_sframes_t frames;
+	frames_t guard = alsa.rate * REWIND_GUARD_MS / 1000;
+	frames_t intact;
+
+	if (!alsa.rewind || !alsa.pcmp || alsa.paused || output.fade || alsa.rewind_frames <= guard) {
+		return;
+	}
+
+	if ((frames = snd_pcm_rewindable(alsa.pcmp)) <= guard) {
+		return;
+	}
+
+	// consumed frames before readp remain intact in outputbuf until the decoder writes over them
+	intact = _buf_space(outputbuf) / output.frame_bytes;
+	if (intact) --intact;
+
+	frames = min(frames - guard, alsa.rewind_frames - guard);
+	frames = min(frames, intact);
+	frames = min(frames, output.frames_played);
+
+	if (frames <= 0 || (frames = snd_pcm_rewind(alsa.pcmp, frames)) <= 0) {
+		return;
+	}
+
+	outputbuf->readp -= frames * output.frame_bytes;
+	if (outputbuf->readp < outputbuf->buf) {
+		outputbuf->readp += outputbuf->size;
+	}
+	output.frames_played -= frames;
+	alsa.rewind_frames -= frames;
+
+	LOG_DEBUG("rewound %d frames for volume change", (int)frames);
+#endif
+}
+
+// called by decode thread with mutex locked, returns frames of the mmap area the next frames of the playing track
+// can be packed into directly, or 0 if they must be queued in outputbuf - only when nothing is queued ahead of them
+// and the output thread would write them unaltered
+frames_t _output_direct_begin(u8_t **ptr, frames_t frames) {
+#if ALSA
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t alsa_frames;
+	snd_pcm_sframes_t avail;
+	int err;
+
+	if (!alsa.direct || !alsa.mmap || !alsa.pcmp || alsa.paused || output.state != OUTPUT_RUNNING || output.fade ||
+		output.track_count || _buf_used(outputbuf) || !output.native_frame_bytes ||
+		output.frame_bytes != output.native_frame_bytes || output.gainL != FIXED_ONE || output.gainR != FIXED_ONE ||
+		(output.current_replay_gain && output.current_replay_gain != FIXED_ONE)) {
+		return 0;
+	}
+
+	if ((avail = snd_pcm_avail_update(alsa.pcmp)) <= 0) {
+		return 0;
+	}
+
+	alsa_frames = min((snd_pcm_uframes_t)avail, frames);
+
+	if ((err = snd_pcm_mmap_begin(alsa.pcmp, &areas, &alsa.direct_offset, &alsa_frames)) < 0) {
+		LOG_DEBUG("direct mmap_begin error: %s", snd_strerror(err));
+		return 0;
+	}
+
+	*ptr = areas[0].addr + (areas[0].first + alsa.direct_offset * areas[0].step) / 8;
+
+	return (frames_t)alsa_frames;
+#else
+	return 0;
+#endif
+}
+
+// called by decode thread with mutex locked once frames returned by _output_direct_begin have been written
+void _output_direct_commit(frames_t frames) {
+#if ALSA
+	snd_pcm_sframes_t w = snd_pcm_mmap_commit(alsa.pcmp, alsa.direct_offset, frames);
+	if (w < 0 || w != frames) {
+		LOG_WARN("direct mmap_commit error");
+		return;
+	}
+	output.frames_played += _drift_played(frames);
+	drift.written += frames;
+	alsa.direct_fed = true;
+	alsa.rewind_frames = 0; // not in outputbuf so can not be written again
+#endif
+}
+
+// called by decode thread with mutex locked once the stream has ended, the output thread then writes to the device
+void _output_direct_end(void) {
+#if ALSA
+	alsa.direct_fed = false;
+#endif
+}
+
+// wake output thread if idle or waiting on the device, called when playback may resume or it has work to do
+void output_wake(void) {
+#if ALSA
+	wake_signal(alsa.wake_e);
+#endif
+}
+
 void output_flush(void) {
 	LOG_INFO("flush output buffer");
 	buf_flush(outputbuf);
 	LOCK;
+#if ALSA
+	// discard frames queued in the device rather than letting them play out, the output thread drops them as the handle
+	// is not used by other threads while it may wait on it, a paused device is left stopped by the drop
+	if (alsa.pcmp) {
+		alsa.drop = true;
+		alsa.paused = false;
+	}
+	alsa.rewind_frames = 0;
+	alsa.direct_fed = false;
+	output.device_frames = 0;
+#endif
 	output.fade = FADE_INACTIVE;
 	output.state = OUTPUT_STOPPED;
 	output.frames_played = 0;
+	output.frames_played_dmp = 0;
+	output.track_count = 0;
+	_output_publish();
+	crossbuf->readp = crossbuf->writep = crossbuf->buf;
 	UNLOCK;
+	output_wake();
 }
 
 void output_close(void) {
@@ -1430,8 +2980,14 @@ void output_close(void) {
 
 #if ALSA
 	UNLOCK;
+	output_wake();
 	pthread_join(thread, NULL);
 	if (alsa.write_buf) free(alsa.write_buf);
+	if (alsa.hw_cache) snd_pcm_hw_params_free(alsa.hw_cache);
+	if (alsa.next.hw_params) snd_pcm_hw_params_free(alsa.next.hw_params);
+	if (alsa.status) snd_pcm_status_free(alsa.status);
+	wake_close(alsa.wake_e);
+	if (alsa.mixer) snd_mixer_close(alsa.mixer);
 #endif
 
 #if PORTAUDIO
@@ -1449,4 +3005,5 @@ void output_close(void) {
 #endif
 
 	buf_destroy(outputbuf);
+	buf_destroy(crossbuf);
 }
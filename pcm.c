@@ -54,7 +54,6 @@ static decode_state pcm_decode(void) {
 	LOCK_O;
 
 	in = min(_buf_used(streambuf), _buf_cont_read(streambuf)) / (channels * sample_size);
-	out = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
 
 	if (stream.state <= DISCONNECT && in == 0) {
 		UNLOCK_O;
@@ -64,12 +63,19 @@ static decode_state pcm_decode(void) {
 
 	if (decode.new_stream) {
 		LOG_INFO("setting track_start");
-		output.next_sample_rate = sample_rate; 
-		output.track_start = outputbuf->writep;
+		output.next_sample_rate = _decode_newstream(sample_rate);
+		if (!_output_track_start()) {
+			UNLOCK_O;
+			UNLOCK_S;
+			return DECODE_ERROR;
+		}
 		if (output.fade_mode) _checkfade(true);
 		decode.new_stream = false;
 	}
 
+	// calculated after track start as a crossfade may move writep
+	out = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
+
 	frames = min(in, out);
 	frames = min(frames, MAX_DECODE_FRAMES);
 
@@ -155,7 +161,7 @@ static decode_state pcm_decode(void) {
 	LOG_SDEBUG("decoded %u frames", frames);
 
 	_buf_inc_readp(streambuf, frames * channels * sample_size);
-	_buf_inc_writep(outputbuf, frames * BYTES_PER_FRAME);
+	_decode_inc_writep(frames * BYTES_PER_FRAME);
 
 	UNLOCK_O;
 	UNLOCK_S;
@@ -0,0 +1,215 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012, 2013, triode1@btinternet.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// sample processing stage between codecs and outputbuf
+// - codecs decode into outputbuf as normal, _process_append moves the new frames into the process stage rather than advancing writep
+// - process_samples runs in the decode thread without the outputbuf mutex so outputbuf is not held during processing
+// - processed frames are held in outbuf until _process_transfer finds space for them in outputbuf, packing them into
+//   the device sample format if the output thread is able to write outputbuf to the device without conversion
+
+#include "squeezelite.h"
+
+extern log_level loglevel;
+
+extern struct buffer *outputbuf;
+
+#define DRAIN_FRAMES 4096
+
+static struct processstate process;
+
+static bool grow(u8_t **buf, frames_t *max_frames, frames_t frames) {
+	u8_t *new;
+
+	if (frames <= *max_frames) {
+		return true;
+	}
+
+	LOG_DEBUG("process buffer grow: %u -> %u frames", *max_frames, frames);
+
+	if ((new = realloc(*buf, frames * BYTES_PER_FRAME)) == NULL) {
+		LOG_ERROR("unable to allocate process buffer");
+		return false;
+	}
+
+	*buf = new;
+	*max_frames = frames;
+
+	return true;
+}
+
+// called by decode thread with both mutexes locked at the start of each stream which passes through the process stage
+void _process_newstream(bool resample, unsigned frame_bytes) {
+	size_t pad;
+
+	process.resample = resample;
+	process.frame_bytes = frame_bytes;
+
+	// transfer in whole multiples of BYTES_PER_FRAME bytes so codecs always find writep aligned for 32 bit frames
+	for (process.align = 1; (process.align * frame_bytes) % BYTES_PER_FRAME; ++process.align);
+
+	// pad with silence so packed frames start on a transfer boundary and never straddle the buffer wrap
+	pad = (outputbuf->writep - outputbuf->buf) % (process.align * frame_bytes);
+	if (pad) {
+		pad = process.align * frame_bytes - pad;
+		LOG_DEBUG("padding %u bytes for %u byte frames", (unsigned)pad, frame_bytes);
+		memset(outputbuf->writep, 0, pad);
+		_buf_inc_writep(outputbuf, pad);
+	}
+}
+
+// called by codecs with outputbuf mutex locked in place of advancing writep
+void _process_append(size_t bytes) {
+	frames_t frames = bytes / BYTES_PER_FRAME;
+
+	if (!process.resample) {
+		// nothing to process, frames only need packing on transfer
+		if (!process_reserve(frames)) {
+			return;
+		}
+		memcpy(process.outbuf + (process.out_offset + process.out_frames) * BYTES_PER_FRAME, outputbuf->writep, bytes);
+		process.out_frames += frames;
+		return;
+	}
+
+	if (!grow(&process.inbuf, &process.max_in_frames, process.in_frames + frames)) {
+		return;
+	}
+
+	memcpy(process.inbuf + process.in_frames * BYTES_PER_FRAME, outputbuf->writep, bytes);
+	process.in_frames += frames;
+}
+
+// ensure outbuf can hold a further frames after those pending
+bool process_reserve(frames_t frames) {
+	if (process.out_offset) {
+		// move frames left over from a partial transfer to the start
+		memmove(process.outbuf, process.outbuf + process.out_offset * BYTES_PER_FRAME, process.out_frames * BYTES_PER_FRAME);
+		process.out_offset = 0;
+	}
+	return grow(&process.outbuf, &process.max_out_frames, process.out_frames + frames);
+}
+
+// pack 32 bit frames into little endian device format
+static void pack(u8_t *optr, s32_t *iptr, frames_t frames) {
+	size_t count = frames * 2;
+
+	if (process.frame_bytes == 4) {
+		s16_t *o = (s16_t *)(void *)optr;
+		while (count--) {
+			*o++ = *iptr++ >> 16;
+		}
+	} else {
+		while (count--) {
+			s32_t s = *iptr++;
+			*optr++ = s >> 8;
+			*optr++ = s >> 16;
+			*optr++ = s >> 24;
+		}
+	}
+}
+
+// copy as many pending frames into outputbuf as space allows, returns true if none remain
+bool _process_transfer(void) {
+	// pack straight into the device mmap area while the output thread has nothing queued ahead of these frames
+	while (process.frame_bytes != BYTES_PER_FRAME && process.out_frames) {
+		u8_t *ptr;
+		frames_t f = _output_direct_begin(&ptr, process.out_frames);
+
+		if (!f) {
+			break;
+		}
+
+		pack(ptr, (s32_t *)(void *)(process.outbuf + process.out_offset * BYTES_PER_FRAME), f);
+		_output_direct_commit(f);
+
+		process.out_offset += f;
+		process.out_frames -= f;
+	}
+
+	while (process.out_frames >= process.align) {
+		frames_t f = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / process.frame_bytes;
+		u8_t *src = process.outbuf + process.out_offset * BYTES_PER_FRAME;
+
+		f = min(f, process.out_frames);
+		f -= f % process.align;
+		if (!f) {
+			break;
+		}
+
+		if (process.frame_bytes == BYTES_PER_FRAME) {
+			memcpy(outputbuf->writep, src, f * BYTES_PER_FRAME);
+		} else {
+			pack(outputbuf->writep, (s32_t *)(void *)src, f);
+		}
+		_buf_inc_writep(outputbuf, f * process.frame_bytes);
+
+		process.out_offset += f;
+		process.out_frames -= f;
+	}
+
+	return process.out_frames < process.align;
+}
+
+bool process_pending(void) {
+	return process.out_frames >= process.align;
+}
+
+// called by decode thread with decode mutex locked, processes all frames appended by the last codec call
+void process_samples(void) {
+#if RESAMPLE
+	if (process.resample && process.in_frames) {
+		resample_samples(&process);
+	}
+#endif
+}
+
+// called by decode thread with decode mutex locked at end of stream to retrieve any frames held by the resampler
+void process_drain(void) {
+	frames_t pad;
+
+#if RESAMPLE
+	if (process.resample) {
+		bool done;
+		do {
+			if (!process_reserve(DRAIN_FRAMES)) {
+				break;
+			}
+			done = resample_drain(&process);
+		} while (!done);
+	}
+#endif
+
+	// complete the last transfer with silence
+	if ((pad = process.out_frames % process.align) != 0 && process_reserve(process.align - pad)) {
+		pad = process.align - pad;
+		memset(process.outbuf + process.out_frames * BYTES_PER_FRAME, 0, pad * BYTES_PER_FRAME);
+		process.out_frames += pad;
+	}
+}
+
+// called with decode mutex locked to discard all frames in the process stage
+void process_flush(void) {
+	process.in_frames = 0;
+	process.out_frames = 0;
+	process.out_offset = 0;
+#if RESAMPLE
+	resample_flush();
+#endif
+}
@@ -0,0 +1,304 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012, 2013, triode1@btinternet.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// resampling using libsoxr - a SIMD optimised polyphase resampler which is loaded dynamically
+// all tracks are resampled to a fixed output rate, or to the rate nearest it in the 44.1k/48k family of the track,
+// so the output device is not reopened on sample rate changes
+// with drift correction tracks are also resampled at variable rate by the dac clock drift measured in the output thread
+
+#include "squeezelite.h"
+
+#if RESAMPLE
+
+#include <soxr.h>
+#include <time.h>
+
+#define RESAMPLE_SLACK_FRAMES 256
+
+extern log_level loglevel;
+
+extern struct outputstate output;
+
+struct soxr {
+	soxr_t resampler;
+	unsigned long q_recipe;
+	unsigned target_rate;
+	bool family;
+	bool convert;
+	bool drift;
+	s32_t drift_ppb;
+	unsigned in_rate, out_rate;
+	double ratio;
+	u64_t in_frames, out_frames;
+	u64_t cpu_ns;
+	// soxr symbols to be dynamically loaded
+	soxr_io_spec_t (* soxr_io_spec)(soxr_datatype_t itype, soxr_datatype_t otype);
+	soxr_quality_spec_t (* soxr_quality_spec)(unsigned long recipe, unsigned long flags);
+	soxr_t (* soxr_create)(double, double, unsigned, soxr_error_t *, soxr_io_spec_t const *, soxr_quality_spec_t const *,
+						   soxr_runtime_spec_t const *);
+	void (* soxr_delete)(soxr_t);
+	soxr_error_t (* soxr_process)(soxr_t, soxr_in_t, size_t, size_t *, soxr_out_t, size_t olen, size_t *);
+	soxr_error_t (* soxr_set_io_ratio)(soxr_t, double io_ratio, size_t slew_len);
+	const char * (* soxr_version)(void);
+};
+
+static struct soxr *r;
+
+// cpu time of the calling thread, used to report the real time factor of the resampler
+static u64_t cpu_ns(void) {
+#if LINUX || OSX
+	struct timespec ts;
+	if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) {
+		return (u64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+#endif
+	return 0;
+}
+
+static void resample_end(void) {
+	if (r->in_frames && r->cpu_ns) {
+		double secs = (double)r->in_frames / r->in_rate;
+		LOG_INFO("resampled %u -> %u frames: " FMT_u64 " -> " FMT_u64 " cpu: %u ms real time factor: %.4f", r->in_rate, r->out_rate,
+				 r->in_frames, r->out_frames, (unsigned)(r->cpu_ns / 1000000), (double)r->cpu_ns / 1000000000 / secs);
+	}
+	r->soxr_delete(r->resampler);
+	r->resampler = NULL;
+}
+
+// pick the multiple of the 44.1k or 48k base rate of the track nearest target, without exceeding the device max rate
+static unsigned family_rate(unsigned raw_sample_rate, unsigned target, unsigned max_sample_rate) {
+	unsigned rate = raw_sample_rate % 11025 ? 48000 : 44100;
+
+	while (rate < target && rate * 2 <= max_sample_rate && (rate * 2 <= target || rate * 2 - target < target - rate)) {
+		rate *= 2;
+	}
+
+	return rate;
+}
+
+// input frames per output frame, output frames are stretched by the dac drift so the track plays at its nominal rate
+static double io_ratio(void) {
+	return (double)r->in_rate / ((double)r->out_rate * (1 + (double)r->drift_ppb / 1000000000));
+}
+
+// called with outputbuf mutex locked, returns the sample rate which frames will be written to outputbuf at
+unsigned resample_newstream(unsigned raw_sample_rate, unsigned max_sample_rate) {
+	unsigned out_rate;
+	soxr_error_t err;
+	soxr_io_spec_t io_spec;
+	soxr_quality_spec_t q_spec;
+
+	if (!r) {
+		return raw_sample_rate;
+	}
+
+	if (r->resampler) {
+		resample_end();
+	}
+
+	output.drift = false;
+
+	out_rate = raw_sample_rate;
+	if (r->convert) {
+		out_rate = r->target_rate ? r->target_rate : max_sample_rate;
+		if (r->family) {
+			out_rate = family_rate(raw_sample_rate, out_rate, max_sample_rate);
+		}
+	}
+
+	if (out_rate == raw_sample_rate && !r->drift) {
+		LOG_INFO("resampling not required at %u", raw_sample_rate);
+		return raw_sample_rate;
+	}
+
+	io_spec = r->soxr_io_spec(SOXR_INT32_I, SOXR_INT32_I);
+	q_spec = r->soxr_quality_spec(r->q_recipe, r->drift ? SOXR_VR : 0);
+
+	// a variable rate resampler is created at the largest io ratio it will be set to
+	r->resampler = r->soxr_create(r->drift ? raw_sample_rate * (1 + DRIFT_MAX_PPM / 1000000.0) : raw_sample_rate, out_rate, 2,
+								  &err, &io_spec, &q_spec, NULL);
+	if (err) {
+		LOG_WARN("unable to create resampler %u -> %u: %s", raw_sample_rate, out_rate, err);
+		r->resampler = NULL;
+		return raw_sample_rate;
+	}
+
+	r->in_rate = raw_sample_rate;
+	r->out_rate = out_rate;
+	r->ratio = (double)out_rate / (double)raw_sample_rate;
+	r->in_frames = r->out_frames = r->cpu_ns = 0;
+
+	if (r->drift) {
+		r->drift_ppb = output.drift_ppb;
+		r->soxr_set_io_ratio(r->resampler, io_ratio(), 0);
+		output.drift = true;
+	}
+
+	LOG_INFO("resampling %u -> %u%s", raw_sample_rate, out_rate, r->drift ? " with drift correction" : "");
+
+	return out_rate;
+}
+
+// called by decode thread, resamples all of inbuf into outbuf after any frames already pending
+void resample_samples(struct processstate *process) {
+	frames_t in_off = 0;
+	u64_t start = cpu_ns();
+
+	// follow the drift estimate, slewing over 100ms so the change in rate is inaudible
+	// drift_ppb is a single word written by the output thread so is read without the outputbuf mutex
+	if (r->drift && r->resampler && r->drift_ppb != output.drift_ppb) {
+		r->drift_ppb = output.drift_ppb;
+		r->soxr_set_io_ratio(r->resampler, io_ratio(), r->out_rate / 10);
+	}
+
+	while (r->resampler && in_off < process->in_frames) {
+		size_t idone, odone, olen;
+		soxr_error_t err;
+
+		if (!process_reserve((frames_t)((process->in_frames - in_off) * r->ratio) + RESAMPLE_SLACK_FRAMES)) {
+			break;
+		}
+
+		olen = process->max_out_frames - process->out_offset - process->out_frames;
+
+		err = r->soxr_process(r->resampler, process->inbuf + in_off * BYTES_PER_FRAME, process->in_frames - in_off, &idone,
+							  process->outbuf + (process->out_offset + process->out_frames) * BYTES_PER_FRAME, olen, &odone);
+		if (err) {
+			LOG_WARN("resample error: %s", err);
+			break;
+		}
+
+		in_off += idone;
+		process->out_frames += odone;
+		r->in_frames += idone;
+		r->out_frames += odone;
+
+		if (!idone && !odone) {
+			break;
+		}
+	}
+
+	process->in_frames = 0;
+	r->cpu_ns += cpu_ns() - start;
+}
+
+// called by decode thread at end of stream to flush frames held in the resampler, returns true once flushed
+bool resample_drain(struct processstate *process) {
+	size_t odone, olen;
+	soxr_error_t err;
+
+	if (!r || !r->resampler) {
+		return true;
+	}
+
+	olen = process->max_out_frames - process->out_offset - process->out_frames;
+
+	err = r->soxr_process(r->resampler, NULL, 0, NULL,
+						  process->outbuf + (process->out_offset + process->out_frames) * BYTES_PER_FRAME, olen, &odone);
+
+	process->out_frames += odone;
+	r->out_frames += odone;
+
+	if (err || odone < olen) {
+		LOG_DEBUG("resampler drained");
+		resample_end();
+		return true;
+	}
+
+	return false;
+}
+
+void resample_flush(void) {
+	if (r && r->resampler) {
+		resample_end();
+	}
+}
+
+static bool load_soxr(void) {
+	void *handle = dlopen(LIBSOXR, RTLD_NOW);
+	char *err;
+
+	if (!handle) {
+		LOG_INFO("dlerror: %s", dlerror());
+		return false;
+	}
+
+	r->soxr_io_spec = dlsym(handle, "soxr_io_spec");
+	r->soxr_quality_spec = dlsym(handle, "soxr_quality_spec");
+	r->soxr_create = dlsym(handle, "soxr_create");
+	r->soxr_delete = dlsym(handle, "soxr_delete");
+	r->soxr_process = dlsym(handle, "soxr_process");
+	r->soxr_set_io_ratio = dlsym(handle, "soxr_set_io_ratio");
+	r->soxr_version = dlsym(handle, "soxr_version");
+
+	if ((err = dlerror()) != NULL) {
+		LOG_INFO("dlerror: %s", err);
+		return false;
+	}
+
+	LOG_INFO("loaded "LIBSOXR" %s", r->soxr_version ? r->soxr_version() : "");
+	return true;
+}
+
+// quality: q(uick), l(ow), m(edium), h(igh), v(ery high) - trading cpu against filter length and passband
+bool resample_active(void) {
+	return r && r->resampler;
+}
+
+// convert: resample tracks to the target rate, drift: resample at variable rate to correct dac clock drift
+bool resample_init(log_level level, const char *quality, unsigned target_rate, bool family, bool convert, bool drift) {
+	// shares the decode log level, set here as it is called before decode_init
+	loglevel = level;
+
+	r = malloc(sizeof(struct soxr));
+	if (!r) {
+		return false;
+	}
+
+	r->resampler = NULL;
+	r->target_rate = target_rate;
+	r->family = family;
+	r->convert = convert;
+	r->drift = drift;
+	r->drift_ppb = 0;
+
+	switch (quality ? quality[0] : 'h') {
+	case 'v': r->q_recipe = SOXR_VHQ; break;
+	case 'm': r->q_recipe = SOXR_MQ; break;
+	case 'l': r->q_recipe = SOXR_LQ; break;
+	case 'q': r->q_recipe = SOXR_QQ; break;
+	case 'h':
+	default:  r->q_recipe = SOXR_HQ; break;
+	}
+
+	if (!load_soxr()) {
+		LOG_WARN("resampling disabled - unable to load "LIBSOXR);
+		free(r);
+		r = NULL;
+		return false;
+	}
+
+	LOG_INFO("resampling enabled, quality: %c target rate: %u%s%s", quality ? quality[0] : 'h', target_rate,
+			 family ? " (nearest in family)" : "", drift ? " drift correction" : "");
+
+	return true;
+}
+
+#endif // RESAMPLE
@@ -45,6 +45,9 @@ extern struct streamstate stream;
 extern struct outputstate output;
 extern struct decodestate decode;
 
+extern struct streamstatus stream_status;
+extern struct outputstatus output_status;
+
 extern struct codec *codecs[];
 
 event_event wake_e;
@@ -57,8 +60,8 @@ event_event wake_e;
 #define UNLOCK_D mutex_unlock(decode.mutex)
 
 static struct {
-	u32_t updated;
-	u32_t stream_start;
+	u64_t updated_us;
+	u64_t stream_start_us;
 	u32_t stream_full;
 	u32_t stream_size;
 	u64_t stream_bytes;
@@ -76,20 +79,144 @@ bool sentSTMu, sentSTMo, sentSTMl;
 u32_t new_server;
 char *new_server_cap;
 
+// packets are queued and sent by the controller loop without blocking, as many as the socket accepts in one call
+// STAT packets are held separately to be sent ahead of packets not yet started, a new STMt replacing one still waiting
+#define TX_BUF_SIZE (4 * MAX_HEADER)
+#define TX_STATS    14
+
+static struct {
+	struct STAT_packet stat[TX_STATS];
+	unsigned stats;
+	size_t stat_sent;          // bytes of stat[0] sent
+	u8_t buf[TX_BUF_SIZE];     // other packets in order
+	size_t len;
+	size_t sent;               // bytes of the packet at the start of buf sent
+	size_t part;               // bytes of the packet being queued still to come
+	bool drop;
+} tx;
+
+// all packets start with a 4 byte opcode and the length of the remainder
+static size_t packet_len(u8_t *packet) {
+	return 8 + unpackN((u32_t *)(packet + 4));
+}
+
+static void tx_reset(void) {
+	tx.stats = 0;
+	tx.stat_sent = tx.len = tx.sent = tx.part = 0;
+	tx.drop = false;
+}
+
+// queue a packet, or part of one following its header - the whole packet is queued or dropped if there is no space
 void send_packet(u8_t *packet, size_t len) {
-	u8_t *ptr = packet;
+	if (!tx.part) {
+		tx.part = packet_len(packet);
+		tx.drop = tx.len + tx.part > TX_BUF_SIZE;
+		if (tx.drop) {
+			LOG_WARN("transmit queue full, dropping %.4s", packet);
+		}
+	}
+
+	if (!tx.drop) {
+		memcpy(tx.buf + tx.len, packet, len);
+		tx.len += len;
+	}
+
+	tx.part -= min(len, tx.part);
+}
+
+static void queue_stat(struct STAT_packet *pkt) {
+	unsigned i;
+
+	if (!memcmp(&pkt->event, "STMt", 4)) {
+		for (i = tx.stat_sent ? 1 : 0; i < tx.stats; ++i) {
+			if (!memcmp(&tx.stat[i].event, "STMt", 4)) {
+				memmove(tx.stat + i, tx.stat + i + 1, (tx.stats - i - 1) * sizeof(struct STAT_packet));
+				--tx.stats;
+				break;
+			}
+		}
+	}
+
+	if (tx.stats < TX_STATS) {
+		tx.stat[tx.stats++] = *pkt;
+	} else {
+		send_packet((u8_t *)pkt, sizeof(struct STAT_packet));
+	}
+}
+
+// send as much of the queue as the socket accepts, a packet already started is completed before any STAT
+static void tx_flush(void) {
+	struct iovec iov[TX_STATS + 2];
+	size_t first = 0, done, off;
 	ssize_t n;
+	int cnt = 0;
+	unsigned i;
+#if !WIN
+	struct msghdr msg;
+#endif
 
-	// may block
-	while (len) {
-		n = send(sock, ptr, len, MSG_NOSIGNAL);
-		if (n < 0) {
+	if (!tx.stats && !tx.len) {
+		return;
+	}
+
+	if (tx.sent) {
+		first = packet_len(tx.buf);
+		iov[cnt].iov_base = tx.buf + tx.sent;
+		iov[cnt++].iov_len = first - tx.sent;
+	}
+	for (i = 0; i < tx.stats; ++i) {
+		off = i ? 0 : tx.stat_sent;
+		iov[cnt].iov_base = (u8_t *)(tx.stat + i) + off;
+		iov[cnt++].iov_len = sizeof(struct STAT_packet) - off;
+	}
+	if (tx.len > first) {
+		iov[cnt].iov_base = tx.buf + first;
+		iov[cnt++].iov_len = tx.len - first;
+	}
+
+#if WIN
+	n = writev(sock, iov, cnt);
+#else
+	// a server closing the socket must not raise SIGPIPE, as nothing ignores it
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = cnt;
+	n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+#endif
+	if (n < 0) {
+		if (last_error() != ERROR_WOULDBLOCK) {
 			LOG_INFO("failed writing to socket: %s", strerror(last_error()));
+		}
+		return;
+	}
+
+	// consume in the order sent, done is bytes of buf sent
+	done = tx.sent;
+	if (tx.sent) {
+		if ((size_t)n < first - tx.sent) {
+			tx.sent += n;
 			return;
 		}
-		ptr += n;
-		len -= n;
+		n -= first - tx.sent;
+		done = first;
+	}
+	while (tx.stats && n > 0) {
+		if ((size_t)n < sizeof(struct STAT_packet) - tx.stat_sent) {
+			tx.stat_sent += n;
+			n = 0;
+			break;
+		}
+		n -= sizeof(struct STAT_packet) - tx.stat_sent;
+		tx.stat_sent = 0;
+		memmove(tx.stat, tx.stat + 1, --tx.stats * sizeof(struct STAT_packet));
 	}
+	done += n;
+
+	// remove whole packets sent, keeping any partly sent at the start of buf
+	for (off = 0; off < tx.len && off + packet_len(tx.buf + off) <= done; off += packet_len(tx.buf + off));
+	memmove(tx.buf, tx.buf + off, tx.len - off);
+	tx.len -= off;
+	tx.sent = done - off;
 }
 
 static void sendHELO(bool reconnect, const char *fixed_cap, const char *var_cap, u8_t mac[6]) {
@@ -116,14 +243,42 @@ static void sendHELO(bool reconnect, const char *fixed_cap, const char *var_cap,
 	send_packet((u8_t *)var_cap, strlen(var_cap));
 }
 
+// copy status published by the stream and output threads, without taking their mutexes
+static void update_status(void) {
+	struct streamstatus s;
+	struct outputstatus o;
+
+	snapshot_read(&s, &stream_status, sizeof(s));
+	snapshot_read(&o, &output_status, sizeof(o));
+
+	status.stream_full = s.full;
+	status.stream_size = s.size;
+	status.stream_bytes = s.bytes;
+	status.stream_state = s.state;
+	status.output_full = o.full;
+	status.output_size = o.size;
+	status.frames_played = o.frames_played;
+	status.device_frames = o.device_frames;
+	status.current_sample_rate = o.current_sample_rate;
+	status.updated_us = o.updated_us;
+}
+
 static void sendSTAT(const char *event, u32_t server_timestamp) {
 	struct STAT_packet pkt;
-	u32_t now = gettime_ms();
+	u64_t now_us;
+	u32_t now;
 	u32_t ms_played;
 
+	update_status();
+
+	now_us = gettime_us();
+	now = (u32_t)(now_us / 1000);
+
+	// elapsed at the dac when the device delay was measured, plus time since then, in us so neither wraps
 	if (status.current_sample_rate && status.frames_played && status.frames_played > status.device_frames) {
-		ms_played = (u32_t)(((u64_t)(status.frames_played - status.device_frames) * (u64_t)1000) / (u64_t)status.current_sample_rate);
-		if (now > status.updated) ms_played += (now - status.updated);
+		u64_t us_played = (u64_t)(status.frames_played - status.device_frames) * 1000000 / status.current_sample_rate;
+		if (now_us > status.updated_us) us_played += now_us - status.updated_us;
+		ms_played = (u32_t)(us_played / 1000);
 	} else {
 		ms_played = 0;
 	}
@@ -151,12 +306,14 @@ static void sendSTAT(const char *event, u32_t server_timestamp) {
 	LOG_INFO("STAT: %s", event);
 
 	if (loglevel == lSDEBUG) {
-		LOG_SDEBUG("received bytesL: %u streambuf: %u outputbuf: %u calc elapsed: %u real elapsed: %u (diff: %u) device: %u delay: %d",
-				   (u32_t)status.stream_bytes, status.stream_full, status.output_full, ms_played, now - status.stream_start,
-				   ms_played - now + status.stream_start, status.device_frames * 1000 / status.current_sample_rate, now - status.updated);
+		u32_t real = (u32_t)((now_us - status.stream_start_us) / 1000);
+		LOG_SDEBUG("received bytesL: %u streambuf: %u outputbuf: %u calc elapsed: %u real elapsed: %u (diff: %d) device: %u delay: %d",
+				   (u32_t)status.stream_bytes, status.stream_full, status.output_full, ms_played, real, (s32_t)(ms_played - real),
+				   status.current_sample_rate ? status.device_frames * 1000 / status.current_sample_rate : 0,
+				   (s32_t)((s64_t)(now_us - status.updated_us) / 1000));
 	}
 
-	send_packet((u8_t *)&pkt, sizeof(pkt));
+	queue_stat(&pkt);
 }
 
 static void sendDSCO(disconnect_code disconnect) {
@@ -223,15 +380,15 @@ static void process_strm(u8_t *pkt, int len) {
 		sendSTAT("STMt", strm->replay_gain); // STMt replay_gain is no longer used to track latency, but support it
 		break;
 	case 'q':
+		decode_flush();
 		output_flush();
-		status.frames_played = 0;
 		stream_disconnect();
 		sendSTAT("STMf", 0);
 		buf_flush(streambuf);
 		break;
 	case 'f':
+		decode_flush();
 		output_flush();
-		status.frames_played = 0;
 		if (stream_disconnect()) {
 			sendSTAT("STMf", 0);
 		}
@@ -243,6 +400,7 @@ static void process_strm(u8_t *pkt, int len) {
 			LOCK_O;
 			output.pause_frames = interval * status.current_sample_rate / 1000;
 			output.state = interval ? OUTPUT_PAUSE_FRAMES : OUTPUT_STOPPED;				
+			if (!interval) _output_pause(true);
 			UNLOCK_O;
 			if (!interval) sendSTAT("STMp", 0);
 			LOG_INFO("pause interval: %u", interval);
@@ -264,7 +422,9 @@ static void process_strm(u8_t *pkt, int len) {
 			LOCK_O;
 			output.state = jiffies ? OUTPUT_START_AT : OUTPUT_RUNNING;
 			output.start_at = jiffies;
+			if (!jiffies) _output_pause(false);
 			UNLOCK_O;
+			output_wake();
 			LOCK_D;
 			decode.state = DECODE_RUNNING;
 			UNLOCK_D;
@@ -285,10 +445,14 @@ static void process_strm(u8_t *pkt, int len) {
 
 			autostart = strm->autostart - '0';
 			sendSTAT("STMf", 0);
+			LOCK_O;
+			output.strm_received = output.state <= OUTPUT_BUFFER ? gettime_ms() : 0;
+			UNLOCK_O;
 			if (header_len > MAX_HEADER -1) {
 				LOG_WARN("header too long: %u", header_len);
 				break;
 			}
+			output_crossbuf_prepare(strm->transition_type - '0', strm->transition_period);
 			codec_open(strm->format, strm->pcm_sample_size, strm->pcm_sample_rate, strm->pcm_channels, strm->pcm_endianness);
 			if (ip == LOCAL_PLAYER_IP && port == LOCAL_PLAYER_PORT) {
 				// extension to slimproto for LocalPlayer - header is filename not http header, don't expect cont
@@ -354,10 +518,7 @@ static void process_audg(u8_t *pkt, int len) {
 
 	LOG_INFO("audg gainL: %u gainR: %u adjust: %u", audg->gainL, audg->gainR, audg->adjust);
 
-	LOCK_O;
-	output.gainL = audg->adjust ? audg->gainL : FIXED_ONE;
-	output.gainR = audg->adjust ? audg->gainR : FIXED_ONE;
-	UNLOCK_O;
+	output_volume(audg->adjust ? audg->gainL : FIXED_ONE, audg->adjust ? audg->gainR : FIXED_ONE);
 }
 
 #define SYNC_CAP ",SyncgroupID="
@@ -414,12 +575,14 @@ static void process(u8_t *pack, int len) {
 
 static bool running;
 
+// received packets are each a 2 byte length followed by the packet, all available are read at once and complete
+// packets handled in place, only a partial packet left at the end is moved to the start for the next read
+#define RXBUF (2 * (MAXBUF + 2))
+
 static void slimproto_run() {
-	static u8_t buffer[MAXBUF];
-	int  expect = 0;
+	static u8_t buffer[RXBUF];
 	int  got    = 0;
 	u32_t now;
-	static u32_t last = 0;
 	event_handle ehandles[2];
 	int timeouts = 0;
 
@@ -430,42 +593,46 @@ static void slimproto_run() {
 		bool wake = false;
 		event_type ev;
 
+		tx_flush();
+
+#if !WINEVENT
+		// wait for the socket to accept more while packets remain queued
+		ehandles[0].events = POLLIN | (tx.stats || tx.len ? POLLOUT : 0);
+#endif
+
 		if ((ev = wait_readwake(ehandles, 1000)) != EVENT_TIMEOUT) {
 	
 			if (ev == EVENT_READ) {
 
-				if (expect > 0) {
-					int n = recv(sock, buffer + got, expect, 0);
-					if (n <= 0) {
-						LOG_INFO("error reading from socket: %s", n ? strerror(last_error()) : "closed");
-						return;
-					}
-					expect -= n;
-					got += n;
-					if (expect == 0) {
-						process(buffer, got);
-						got = 0;
-					}
-				} else if (expect == 0) {
-					int n = recv(sock, buffer + got, 2 - got, 0);
-					if (n <= 0) {
-						LOG_INFO("error reading from socket: %s", n ? strerror(last_error()) : "closed");
+				int off = 0;
+				int n = recv(sock, buffer + got, RXBUF - got, 0);
+				if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
+					continue;
+				}
+				if (n <= 0) {
+					LOG_INFO("error reading from socket: %s", n ? strerror(last_error()) : "closed");
+					return;
+				}
+				got += n;
+
+				while (got - off >= 2 && !new_server) {
+					int expect = buffer[off] << 8 | buffer[off + 1]; // length pack 'n'
+					if (expect > MAXBUF) {
+						LOG_ERROR("FATAL: slimproto packet too big: %d > %d", expect, MAXBUF);
 						return;
 					}
-					got += n;
-					if (got == 2) {
-						expect = buffer[0] << 8 | buffer[1]; // length pack 'n'
-						got = 0;
-						if (expect > MAXBUF) {
-							LOG_ERROR("FATAL: slimproto packet too big: %d > %d", expect, MAXBUF);
-							return;
-						}
+					if (got - off - 2 < expect) {
+						break;
 					}
-				} else {
-					LOG_ERROR("FATAL: negative expect");
-					return;
+					process(buffer + off + 2, expect);
+					off += 2 + expect;
+					wake = true;
 				}
 
+				if (off) {
+					got -= off;
+					memmove(buffer, buffer + off, got);
+				}
 			}
 
 			if (ev == EVENT_WAKE) {
@@ -481,10 +648,17 @@ static void slimproto_run() {
 			return;
 		}
 
-		// update playback state when woken or every 100ms
+		// state changes are signalled by other threads waking us, or made here processing server messages, and handled
+		// under the mutexes - otherwise report progress each second from status published without them
 		now = gettime_ms();
 
-		if (wake || now - last > 100 || last > now) {
+		if (!wake) {
+			// decode.state is a single word so is read without the decode mutex
+			if (decode.state == DECODE_RUNNING && now - status.last > 1000) {
+				status.last = now;
+				sendSTAT("STMt", 0);
+			}
+		} else {
 			bool _sendSTMs = false;
 			bool _sendDSCO = false;
 			bool _sendRESP = false;
@@ -498,12 +672,9 @@ static void slimproto_run() {
 			disconnect_code disconnect;
 			static char header[MAX_HEADER];
 			size_t header_len = 0;
-			last = now;
+			bool output_empty;
 
 			LOCK_S;
-			status.stream_full = _buf_used(streambuf);
-			status.stream_size = streambuf->size;
-			status.stream_bytes = stream.bytes;
 			status.stream_state = stream.state;
 						
 			if (stream.state == DISCONNECT) {
@@ -527,17 +698,12 @@ static void slimproto_run() {
 			UNLOCK_S;
 			
 			LOCK_O;
-			status.output_full = _buf_used(outputbuf);
-			status.output_size = outputbuf->size;
-			status.frames_played = output.frames_played;
-			status.current_sample_rate = output.current_sample_rate;
-			status.updated = output.updated;
-			status.device_frames = output.device_frames;
+			output_empty = _buf_used(outputbuf) == 0;
 			
 			if (output.track_started) {
 				_sendSTMs = true;
 				output.track_started = false;
-				status.stream_start = output.updated;
+				status.stream_start_us = output.updated_us;
 			}
 #if PORTAUDIO
 			if (output.pa_reopen) {
@@ -545,11 +711,11 @@ static void slimproto_run() {
 				output.pa_reopen = false;
 			}
 #endif
-			if (output.state == OUTPUT_RUNNING && !sentSTMu && status.output_full == 0 && status.stream_state <= DISCONNECT) {
+			if (output.state == OUTPUT_RUNNING && !sentSTMu && output_empty && status.stream_state <= DISCONNECT) {
 				_sendSTMu = true;
 				sentSTMu = true;
 			}
-			if (output.state == OUTPUT_RUNNING && !sentSTMo && status.output_full == 0 && status.stream_state == STREAMING_HTTP) {
+			if (output.state == OUTPUT_RUNNING && !sentSTMo && output_empty && status.stream_state == STREAMING_HTTP) {
 				_sendSTMo = true;
 				sentSTMo = true;
 			}
@@ -580,6 +746,7 @@ static void slimproto_run() {
 						output.state = OUTPUT_BUFFER;
 					}
 					UNLOCK_O;
+					output_wake();
 				}
 				// autostart 2 and 3 require cont to be received first
 			}
@@ -605,11 +772,113 @@ void wake_controller(void) {
 	wake_signal(wake_e);
 }
 
-in_addr_t discover_server(void) {
+#define DISCOVERY_MIN_MS   100  // discovery is resent and reconnection retried at intervals doubling from min to max
+#define DISCOVERY_MAX_MS   5000
+#define CONNECT_TIMEOUT_MS 2000
+
+#if LINUX || OSX
+// the last server connected to is kept so it can be tried at start while discovery runs
+#define SERVER_CACHE ".squeezelite.server"
+
+static char cache_path[256] = ""; // empty if not cached
+
+// file set with -s, otherwise in HOME, not cached if HOME is unset as when started by init rather than in the cwd
+static void cache_init(const char *file) {
+	const char *home = getenv("HOME");
+
+	if (file) {
+		snprintf(cache_path, sizeof(cache_path), "%s", file);
+	} else if (home && home[0]) {
+		snprintf(cache_path, sizeof(cache_path), "%s/" SERVER_CACHE, home);
+	} else {
+		LOG_INFO("HOME not set - last server not cached");
+	}
+}
+
+static in_addr_t cached_server(void) {
+	char ip[16] = "";
+	FILE *fp;
+
+	if (cache_path[0] && (fp = fopen(cache_path, "r"))) {
+		if (!fgets(ip, sizeof(ip), fp)) ip[0] = '\0';
+		fclose(fp);
+	}
+
+	return ip[0] ? inet_addr(ip) : 0;
+}
+
+static void cache_server(in_addr_t addr) {
+	struct in_addr in;
+	FILE *fp;
+
+	if (!cache_path[0] || addr == cached_server()) {
+		return;
+	}
+
+	in.s_addr = addr;
+	if ((fp = fopen(cache_path, "w"))) {
+		fprintf(fp, "%s\n", inet_ntoa(in));
+		fclose(fp);
+	}
+}
+#else
+#define cache_init(file)
+#define cached_server() 0
+#define cache_server(addr)
+#endif
+
+// start a connection without waiting for it to complete, returns false if it failed immediately
+static bool connect_start(sockfd s, in_addr_t addr) {
+	struct sockaddr_in a;
+
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = addr;
+	a.sin_port = htons(PORT);
+
+	set_nonblock(s);
+
+	if (connect(s, (struct sockaddr *) &a, sizeof(a)) < 0) {
+#if WIN
+		return last_error() == WSAEWOULDBLOCK;
+#else
+		return last_error() == EINPROGRESS;
+#endif
+	}
+
+	return true;
+}
+
+// called once a started connection is writable, returns true if it succeeded
+static bool connect_done(sockfd s) {
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	return getsockopt(s, SOL_SOCKET, SO_ERROR, (void *)&err, &len) == 0 && err == 0;
+}
+
+// connect within a timeout so an unreachable server is retried rather than waiting for the stack to give up
+static bool connect_timeout(sockfd s, in_addr_t addr, int timeout_ms) {
+	struct pollfd pollinfo;
+
+	if (!connect_start(s, addr)) {
+		return false;
+	}
+
+	pollinfo.fd = s;
+	pollinfo.events = POLLOUT;
+
+	return poll(&pollinfo, 1, timeout_ms) == 1 && connect_done(s);
+}
+
+// broadcast for a server, resending at increasing intervals, while trying the last server if known - first to answer wins
+in_addr_t discover_server(in_addr_t last) {
     struct sockaddr_in d;
     struct sockaddr_in s;
 	char *buf;
-	struct pollfd pollinfo;
+	struct pollfd pollinfo[2];
+	sockfd probe = -1;
+	int wait = DISCOVERY_MIN_MS;
 
 	int disc_sock = socket(AF_INET, SOCK_DGRAM, 0);
 
@@ -623,36 +892,69 @@ in_addr_t discover_server(void) {
 	d.sin_port = htons(PORT);
     d.sin_addr.s_addr = htonl(INADDR_BROADCAST);
 
-	pollinfo.fd = disc_sock;
-	pollinfo.events = POLLIN;
+	pollinfo[0].fd = disc_sock;
+	pollinfo[0].events = POLLIN;
+
+#if !WIN
+	// poll on windows only supports one socket
+	if (last) {
+		probe = socket(AF_INET, SOCK_STREAM, 0);
+		if (connect_start(probe, last)) {
+			pollinfo[1].fd = probe;
+			pollinfo[1].events = POLLOUT;
+		} else {
+			closesocket(probe);
+			probe = -1;
+		}
+	}
+#endif
+
+	memset(&s, 0, sizeof(s));
 
 	do {
 
 		LOG_INFO("sending discovery");
-		memset(&s, 0, sizeof(s));
 
 		if (sendto(disc_sock, buf, 1, 0, (struct sockaddr *)&d, sizeof(d)) < 0) {
 			LOG_INFO("error sending disovery");
 		}
 
-		if (poll(&pollinfo, 1, 5000) == 1) {
-			char readbuf[10];
-			socklen_t slen = sizeof(s);
-			recvfrom(disc_sock, readbuf, 10, 0, (struct sockaddr *)&s, &slen);
-			LOG_INFO("got response from: %s:%d", inet_ntoa(s.sin_addr), ntohs(s.sin_port));
+		if (poll(pollinfo, probe >= 0 ? 2 : 1, wait) > 0) {
+			if (pollinfo[0].revents) {
+				char readbuf[10];
+				socklen_t slen = sizeof(s);
+				recvfrom(disc_sock, readbuf, 10, 0, (struct sockaddr *)&s, &slen);
+				LOG_INFO("got response from: %s:%d", inet_ntoa(s.sin_addr), ntohs(s.sin_port));
+			} else if (probe >= 0 && pollinfo[1].revents) {
+				if (connect_done(probe)) {
+					s.sin_addr.s_addr = last;
+					LOG_INFO("last server available: %s", inet_ntoa(s.sin_addr));
+				} else {
+					LOG_INFO("last server not available");
+				}
+				closesocket(probe);
+				probe = -1;
+			}
 		}
 
+		wait = min(wait * 2, DISCOVERY_MAX_MS);
+
 	} while (s.sin_addr.s_addr == 0 && running);
 
+	if (probe >= 0) {
+		closesocket(probe);
+	}
+
 	closesocket(disc_sock);
 
 	return s.sin_addr.s_addr;
 }
 
-void slimproto(log_level level, in_addr_t addr, u8_t mac[6], const char *name) {
+void slimproto(log_level level, in_addr_t addr, u8_t mac[6], const char *name, const char *cache) {
     struct sockaddr_in serv_addr;
 	static char fixed_cap[128], var_cap[128] = "";
 	bool reconnect = false;
+	int backoff = DISCOVERY_MIN_MS;
 	int i;
 
 	wake_create(wake_e);
@@ -660,7 +962,25 @@ void slimproto(log_level level, in_addr_t addr, u8_t mac[6], const char *name) {
 	loglevel = level;
 	running = true;
 
-	slimproto_ip = addr ? addr : discover_server();
+	cache_init(cache);
+
+	slimproto_ip = addr ? addr : discover_server(cached_server());
+
+	LOG_INFO("startup: server found at %u ms", startup_ms());
+
+	// capabilities are known once the output thread has probed the device and the decode thread loaded codecs,
+	// which run while the server is found
+	while (running) {
+		bool ready;
+		LOCK_D;
+		ready = decode.ready;
+		UNLOCK_D;
+		LOCK_O;
+		ready = ready && output.ready;
+		UNLOCK_O;
+		if (ready) break;
+		usleep(10000);
+	}
 
 	if (!running) return;
 
@@ -675,6 +995,8 @@ void slimproto(log_level level, in_addr_t addr, u8_t mac[6], const char *name) {
 	}
 	UNLOCK_O;
 
+	LOG_INFO("startup: capabilities known at %u ms", startup_ms());
+
 	memset(&serv_addr, 0, sizeof(serv_addr));
 	serv_addr.sin_family = AF_INET;
 	serv_addr.sin_addr.s_addr = slimproto_ip;
@@ -695,17 +1017,37 @@ void slimproto(log_level level, in_addr_t addr, u8_t mac[6], const char *name) {
 
 		sock = socket(AF_INET, SOCK_STREAM, 0);
 
-		if (connect(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+		if (!connect_timeout(sock, serv_addr.sin_addr.s_addr, CONNECT_TIMEOUT_MS)) {
 
-			LOG_INFO("unable to connect to server");
-			sleep(5);
+			LOG_INFO("unable to connect to server, retry in %d ms", backoff);
+			usleep(backoff * 1000);
+			backoff = min(backoff * 2, DISCOVERY_MAX_MS);
 
 		} else {
 
 			LOG_INFO("connected");
 
+			backoff = DISCOVERY_MIN_MS;
+			cache_server(serv_addr.sin_addr.s_addr);
+
 			set_nosigpipe(sock);
 
+#if LINUX
+			// find a dead connection in seconds rather than waiting for the server message timeout, the output thread
+			// plays what is buffered meanwhile and the server resumes the player when it reconnects
+			int keepalive = 1, idle = 5, intvl = 1, cnt = 3;
+			setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (const void *)&keepalive, sizeof(keepalive));
+			setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, (const void *)&idle, sizeof(idle));
+			setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, (const void *)&intvl, sizeof(intvl));
+			setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, (const void *)&cnt, sizeof(cnt));
+#endif
+
+			// STAT replies carry timing so should not wait to be coalesced by the stack
+			int nodelay = 1;
+			setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const void *)&nodelay, sizeof(nodelay));
+
+			tx_reset();
+
 			var_cap[0] = '\0';
 
 #if !WIN
@@ -732,6 +1074,10 @@ void slimproto(log_level level, in_addr_t addr, u8_t mac[6], const char *name) {
 
 			sendHELO(reconnect, fixed_cap, var_cap, mac);
 
+			if (!reconnect) {
+				LOG_INFO("startup: HELO queued at %u ms", startup_ms());
+			}
+
 			if (name) {
 				sendSETDName(name);
 				name = NULL;
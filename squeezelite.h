@@ -45,6 +45,13 @@
 #define PORTAUDIO 1
 #endif
 
+#if defined(RESAMPLE)
+#undef RESAMPLE
+#define RESAMPLE  1 // resampling
+#else
+#define RESAMPLE  0
+#endif
+
 #if LINUX && !defined(SELFPIPE)
 #define EVENTFD   1
 #define SELFPIPE  0
@@ -69,6 +76,7 @@
 #define LIBVORBIS "libvorbisfile.so.3"
 #define LIBTREMOR "libvorbisidec.so.1"
 #define LIBFAAD "libfaad.so.2"
+#define LIBSOXR "libsoxr.so.0"
 #endif
 
 #if OSX
@@ -78,6 +86,7 @@
 #define LIBVORBIS "libvorbisfile.3.dylib"
 #define LIBTREMOR "libvorbisidec.1.dylib"
 #define LIBFAAD "libfaad.2.dylib"
+#define LIBSOXR "libsoxr.0.dylib"
 #endif
 
 #if WIN
@@ -87,15 +96,22 @@
 #define LIBVORBIS "libvorbisfile.dll"
 #define LIBTREMOR "libvorbisidec.dll"
 #define LIBFAAD "libfaad2.dll"
+#define LIBSOXR "libsoxr.dll"
 #endif
 
 // config options
 #define STREAMBUF_SIZE (2 * 1024 * 1024)
 #define OUTPUTBUF_SIZE (44100 * 8 * 10)
-#define OUTPUTBUF_SIZE_CROSSFADE (OUTPUTBUF_SIZE * 12 / 10)
+#define STREAMBUF_SECS 10 // buffers are resized between tracks to hold this long at the bitrate and sample rate of the track
+#define OUTPUTBUF_SECS 10
+#define STREAMBUF_MIN  (256 * 1024)
+#define OUTPUTBUF_MIN  (44100 * 8)
+#define BUFFER_MAX     (64 * 1024 * 1024) // default cap on the size of both buffers together
 
 #define MAX_HEADER 4096 // do not reduce as icy-meta max is 4080
 
+#define DRIFT_MAX_PPM 500 // largest dac clock drift corrected by resampling
+
 #if ALSA
 #define ALSA_BUFFER_TIME  20000
 #define ALSA_PERIOD_COUNT 4
@@ -119,6 +135,8 @@
 #include <arpa/inet.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <dlfcn.h>
 #include <pthread.h>
@@ -130,6 +148,7 @@
 #define thread_t pthread_t;
 #define closesocket(s) close(s)
 #define last_error() errno
+#define ERROR_WOULDBLOCK EWOULDBLOCK
 
 typedef u_int8_t  u8_t;
 typedef u_int16_t u16_t;
@@ -146,6 +165,7 @@ typedef int64_t   s64_t;
 #define mutex_unlock(m) pthread_mutex_unlock(&m)
 #define mutex_destroy(m) pthread_mutex_destroy(&m)
 #define thread_type pthread_t
+#define memory_barrier() __sync_synchronize()
 
 #endif
 
@@ -180,10 +200,12 @@ typedef BOOL bool;
 #define mutex_unlock(m) ReleaseMutex(m)
 #define mutex_destroy(m) CloseHandle(m)
 #define thread_type HANDLE
+#define memory_barrier() MemoryBarrier()
 
 #define usleep(x) Sleep(x/1000)
 #define sleep(x) Sleep(x*1000)
 #define last_error() WSAGetLastError()
+#define ERROR_WOULDBLOCK WSAEWOULDBLOCK
 #define open _open
 #define read _read
 
@@ -248,6 +270,7 @@ struct wake {
 #define BYTES_PER_FRAME 8
 
 #define min(a,b) (((a) < (b)) ? (a) : (b))
+#define max(a,b) (((a) > (b)) ? (a) : (b))
 
 // logging
 typedef enum { lERROR = 0, lWARN, lINFO, lDEBUG, lSDEBUG } log_level;
@@ -262,9 +285,11 @@ void logprint(const char *fmt, ...);
 #define LOG_SDEBUG(fmt, ...) if (loglevel >= lSDEBUG) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
 
 // utils.c (non logging)
-typedef enum { EVENT_TIMEOUT = 0, EVENT_READ, EVENT_WAKE } event_type;
+typedef enum { EVENT_TIMEOUT = 0, EVENT_READ, EVENT_WAKE, EVENT_WRITE } event_type;
 
 u32_t gettime_ms(void);
+u64_t gettime_us(void);
+u32_t startup_ms(void);
 void get_mac(u8_t *mac);
 void set_nonblock(sockfd s);
 in_addr_t server_addr(const char *server);
@@ -274,6 +299,12 @@ void packN(u32_t *dest, u32_t val);
 void packn(u16_t *dest, u16_t val);
 u32_t unpackN(u32_t *src);
 u16_t unpackn(u16_t *src);
+void snapshot_read(void *dst, const void *src, size_t size);
+
+// snapshots are structs starting with a volatile unsigned seq, published by a writer holding the mutex of the state
+// they copy, and read with snapshot_read by other threads without it
+#define snapshot_begin(s) do { (s).seq++; memory_barrier(); } while (0)
+#define snapshot_end(s)   do { memory_barrier(); (s).seq++; } while (0)
 #if OSX
 void set_nosigpipe(sockfd s);
 #else
@@ -286,6 +317,8 @@ void *dlopen(const char *filename, int flag);
 void *dlsym(void *handle, const char *symbol);
 char *dlerror(void);
 int poll(struct pollfd *fds, unsigned long numfds, int timeout);
+struct iovec { void *iov_base; size_t iov_len; };
+ssize_t writev(sockfd s, const struct iovec *iov, int iovcnt);
 #endif
 #if LINUX
 void touch_memory(u8_t *buf, size_t size);
@@ -302,6 +335,16 @@ struct buffer {
 	mutex_type mutex;
 };
 
+// resize of a buffer allocated and filled without its mutex held
+struct bufresize {
+	u8_t *buf;                 // new allocation, or the old one once committed, for the caller to free
+	u8_t *old;
+	u8_t *readp;               // readp and bytes used when the contents were copied
+	size_t used;
+	size_t offset;
+	size_t size;
+};
+
 // _* called with mutex locked
 unsigned _buf_used(struct buffer *buf);
 unsigned _buf_space(struct buffer *buf);
@@ -311,12 +354,13 @@ void _buf_inc_readp(struct buffer *buf, unsigned by);
 void _buf_inc_writep(struct buffer *buf, unsigned by);
 void buf_flush(struct buffer *buf);
 void buf_adjust(struct buffer *buf, size_t mod);
-void _buf_resize(struct buffer *buf, size_t size);
+bool buf_resize_prepare(struct buffer *buf, struct bufresize *r, size_t size, size_t align);
+bool _buf_resize_commit(struct buffer *buf, struct bufresize *r, u8_t **ptrs[], unsigned count);
 void buf_init(struct buffer *buf, size_t size);
 void buf_destroy(struct buffer *buf);
 
 // slimproto.c
-void slimproto(log_level level, in_addr_t addr, u8_t mac[6], const char *name);
+void slimproto(log_level level, in_addr_t addr, u8_t mac[6], const char *name, const char *cache);
 void slimproto_stop(void);
 void wake_controller(void);
 
@@ -338,6 +382,17 @@ struct streamstate {
 	u32_t meta_next;
 	u32_t meta_left;
 	bool  meta_send;
+	u32_t throughput;          // bytes per second received, rolling estimate while streambuf has space
+};
+
+// published by stream thread for the controller
+struct streamstatus {
+	volatile unsigned seq;
+	stream_state state;
+	unsigned full;
+	unsigned size;
+	u64_t bytes;
+	u32_t throughput;
 };
 
 void stream_init(log_level level, unsigned stream_buf_size);
@@ -353,6 +408,8 @@ struct decodestate {
 	decode_state state;
 	bool new_stream;
 	mutex_type mutex;
+	bool process;              // decoded frames pass through process stage rather than directly into outputbuf
+	bool ready;                // set in decode thread once codecs are registered
 };
 
 struct codec {
@@ -365,9 +422,48 @@ struct codec {
 	decode_state (*decode)(void);
 };
 
-void decode_init(log_level level, const char *opt);
+void decode_init(log_level level, const char *opt, unsigned stream_secs, unsigned output_secs, unsigned buffer_max);
 void decode_close(void);
+void decode_flush(void);
+size_t decode_buffer_room(void);
 void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels, u8_t endianness);
+// _* called by codecs with outputbuf mutex locked
+unsigned _decode_newstream(unsigned sample_rate);
+void _decode_inc_writep(size_t bytes);
+
+// process.c
+struct processstate {
+	u8_t *inbuf;
+	u8_t *outbuf;
+	frames_t in_frames;
+	frames_t max_in_frames;
+	frames_t out_frames;
+	frames_t out_offset;
+	frames_t max_out_frames;
+	bool resample;             // frames are resampled, otherwise passed straight to outbuf
+	unsigned frame_bytes;      // bytes per frame written to outputbuf, less than BYTES_PER_FRAME if packed to device format
+	frames_t align;            // frames are transferred in multiples of align so writep stays aligned to the buffer wrap
+};
+
+void process_samples(void);
+void process_drain(void);
+void process_flush(void);
+bool process_pending(void);
+bool process_reserve(frames_t frames);
+// _* called with outputbuf mutex locked as well as decode mutex
+void _process_newstream(bool resample, unsigned frame_bytes);
+void _process_append(size_t bytes);
+bool _process_transfer(void);
+
+#if RESAMPLE
+// resample.c
+bool resample_init(log_level level, const char *quality, unsigned target_rate, bool family, bool convert, bool drift);
+unsigned resample_newstream(unsigned raw_sample_rate, unsigned max_sample_rate);
+bool resample_active(void);
+void resample_samples(struct processstate *process);
+bool resample_drain(struct processstate *process);
+void resample_flush(void);
+#endif
 
 // output.c
 typedef enum { OUTPUT_OFF = -1, OUTPUT_STOPPED = 0, OUTPUT_BUFFER, OUTPUT_RUNNING, 
@@ -377,6 +473,17 @@ typedef enum { FADE_INACTIVE = 0, FADE_DUE, FADE_ACTIVE } fade_state;
 typedef enum { FADE_UP = 1, FADE_DOWN, FADE_CROSS } fade_dir;
 typedef enum { FADE_NONE = 0, FADE_CROSSFADE, FADE_IN, FADE_OUT, FADE_INOUT } fade_mode;
 
+#define TRACK_STARTS 8 // track starts queued in outputbuf, the decoder does not start a stream while all are in use
+
+struct trackstart {
+	u8_t *pos;                 // first frame of the track in outputbuf
+	unsigned sample_rate;
+	unsigned frame_bytes;
+	u32_t replay_gain;
+	fade_mode fade_mode;
+	unsigned fade_secs;
+};
+
 struct outputstate {
 	output_state state;
 	const char *device;
@@ -390,21 +497,29 @@ struct outputstate {
 	unsigned latency;
 #endif
 	unsigned frames_played;
+	unsigned frames_played_dmp; // frames played when device_frames was measured
 	unsigned current_sample_rate;
 	unsigned max_sample_rate;
 	unsigned device_frames;
-	u32_t updated;
+	u64_t updated_us;          // gettime_us at which device_frames was measured
 	u32_t current_replay_gain;
 	union {
 		u32_t pause_frames;
 		u32_t skip_frames;
 		u32_t start_at;
 	};
-	unsigned next_sample_rate; // set in decode thread
-	u8_t  *track_start;        // set in decode thread
+	unsigned next_sample_rate; // set in decode thread, sample rate of the last track started
+	struct trackstart tracks[TRACK_STARTS]; // pushed in decode thread in outputbuf order, popped by output thread
+	unsigned track_head;
+	unsigned track_count;
+	unsigned frame_bytes;      // bytes per frame of outputbuf at readp, less than BYTES_PER_FRAME if in device format
+	unsigned next_frame_bytes; // set in decode thread, bytes per frame of the last track started
+	unsigned tail_frame_bytes; // set in decode thread, bytes per frame of the track before it
+	unsigned native_frame_bytes; // set in output thread, device frame size decoders may store frames in, 0 if not
 	u32_t gainL;               // set by slimproto
 	u32_t gainR;               // set by slimproto
 	u32_t next_replay_gain;    // set by slimproto
+	u32_t cross_replay_gain;   // set in output thread, replay gain of the track crossfading in
 	unsigned threshold;        // set by slimproto
 	fade_state fade;
 	u8_t *fade_start;
@@ -412,19 +527,49 @@ struct outputstate {
 	fade_dir fade_dir;
 	fade_mode fade_mode;       // set by slimproto
 	unsigned fade_secs;        // set by slimproto
+	size_t cross_size;         // set by slimproto, crossbuf wanted for the fade mode, counted against the buffer cap
+	u32_t strm_received;       // set by slimproto, time of strm s when not playing, to trace start latency
+	unsigned xruns;            // set in output thread, device xruns since start
+	unsigned xrun_rate;        // set in output thread, device xruns in the last minute
+	bool ready;                // set in output thread once max_sample_rate is known
+	u32_t bitrate;             // set in decode thread, stream bytes per second of audio decoded, 0 if not yet known
+	bool drift;                // set in decode thread, frames are resampled to correct dac clock drift
+	s32_t drift_ppb;           // set in output thread, dac clock rate ahead of the local clock in parts per billion
+};
+
+// published by output thread for the controller
+struct outputstatus {
+	volatile unsigned seq;
+	output_state state;
+	unsigned full;
+	unsigned size;
+	unsigned frames_played;
+	unsigned device_frames;
+	unsigned current_sample_rate;
+	u64_t updated_us;
 };
 
 void list_devices(void);
 #if ALSA
-void output_init(log_level level, const char *device, unsigned output_buf_size, unsigned buffer_time, unsigned period_count, const char *alsa_sample_fmt, bool mmap, unsigned max_rate, unsigned rt_priority);
+void output_init(log_level level, const char *device, unsigned output_buf_size, unsigned buffer_time, unsigned period_count, const char *alsa_sample_fmt, bool mmap, bool rewind, unsigned native, const char *mixer_ctl, unsigned tsched_ms, unsigned tune_max_ms, unsigned idle_secs, unsigned max_rate, unsigned rt_priority);
 #endif
 #if PORTAUDIO
 void output_init(log_level level, const char *device, unsigned output_buf_size, unsigned latency, unsigned max_rate);
 #endif
 void output_flush(void);
+void output_volume(u32_t gainL, u32_t gainR);
+void output_wake(void);
 void output_close(void);
+void output_crossbuf_prepare(fade_mode mode, unsigned secs);
 // _* called with mutex locked
 void _checkfade(bool);
+void _output_pause(bool pause);
+void _output_rewind(void);
+frames_t _output_direct_begin(u8_t **ptr, frames_t frames);
+void _output_direct_commit(frames_t frames);
+void _output_direct_end(void);
+bool output_resize(size_t size);
+bool _output_track_start(void);
 void _pa_open(void);
 
 // codecs
@@ -36,6 +36,49 @@ static sockfd fd;
 
 struct streamstate stream;
 
+struct streamstatus stream_status;
+
+#define THROUGHPUT_WINDOW_US 500000
+#define STREAM_START_MS      250 // streaming starts at the server threshold or this much data at the throughput
+
+// bytes received over the current window of the throughput estimate, restarted while streambuf is full
+static struct {
+	u64_t start_us;
+	u64_t bytes;
+} window;
+
+// called with mutex locked as bytes are received
+static void _throughput_update(size_t n) {
+	u64_t now = gettime_us();
+
+	if (!window.start_us) {
+		window.start_us = now;
+		window.bytes = 0;
+		return;
+	}
+
+	window.bytes += n;
+
+	if (now - window.start_us >= THROUGHPUT_WINDOW_US) {
+		u32_t rate = (u32_t)(window.bytes * 1000000 / (now - window.start_us));
+		stream.throughput = stream.throughput ? (stream.throughput * 3 + rate) / 4 : rate;
+		window.start_us = now;
+		window.bytes = 0;
+		LOG_SDEBUG("throughput: %u bytes/s", stream.throughput);
+	}
+}
+
+// called with mutex locked, publishes state for the controller to read without the mutex
+static void _stream_publish(void) {
+	snapshot_begin(stream_status);
+	stream_status.state = stream.state;
+	stream_status.full = _buf_used(streambuf);
+	stream_status.size = streambuf->size;
+	stream_status.bytes = stream.bytes;
+	stream_status.throughput = stream.throughput;
+	snapshot_end(stream_status);
+}
+
 static void send_header(void) {
 	char *ptr = stream.header;
 	int len = stream.header_len;
@@ -71,6 +114,7 @@ static void _disconnect(stream_state state, disconnect_code disconnect) {
 	stream.disconnect = disconnect;
 	closesocket(fd);
 	fd = -1;
+	_stream_publish();
 	wake_controller();
 }
 
@@ -83,6 +127,10 @@ static void *stream_thread() {
 
 		LOCK;
 		space = min(_buf_space(streambuf), _buf_cont_write(streambuf));
+		if (!space) {
+			window.start_us = 0;
+		}
+		_stream_publish();
 		UNLOCK;
 
 		if (fd >= 0 && stream.state > STREAMING_WAIT && space) {
@@ -234,9 +282,14 @@ static void *stream_thread() {
 						if (stream.meta_interval) {
 							stream.meta_next -= n;
 						}
+						_throughput_update(n);
 					}
 
-					if (stream.state == STREAMING_BUFFERING && stream.bytes > stream.threshold) {
+					// decoding starts early on a slow stream, the output thread holds playback until it will not underrun
+					if (stream.state == STREAMING_BUFFERING && (stream.bytes > stream.threshold ||
+						(stream.throughput && stream.bytes > (u64_t)stream.throughput * STREAM_START_MS / 1000))) {
+						LOG_INFO("streaming: %u bytes threshold: %u throughput: %u bytes/s", (u32_t)stream.bytes,
+								 stream.threshold, stream.throughput);
 						stream.state = STREAMING_HTTP;
 						wake_controller();
 					}
@@ -245,6 +298,7 @@ static void *stream_thread() {
 				}
 			}
 
+			_stream_publish();
 			UNLOCK;
 			
 		} else {
@@ -330,7 +384,10 @@ void stream_file(const char *header, size_t header_len, unsigned threshold) {
 	stream.sent_headers = false;
 	stream.bytes = 0;
 	stream.threshold = threshold;
+	stream.throughput = 0;
+	window.start_us = 0;
 
+	_stream_publish();
 	UNLOCK;
 }
 
@@ -383,7 +440,10 @@ void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, un
 	stream.sent_headers = false;
 	stream.bytes = 0;
 	stream.threshold = threshold;
+	stream.throughput = 0;
+	window.start_us = 0;
 
+	_stream_publish();
 	UNLOCK;
 }
 
@@ -396,6 +456,7 @@ bool stream_disconnect(void) {
 		disc = true;
 	}
 	stream.state = STOPPED;
+	_stream_publish();
 	UNLOCK;
 	return disc;
 }
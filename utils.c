@@ -61,22 +61,50 @@ void logprint(const char *fmt, ...) {
 }
 
 // clock
+// jiffies, wrapping every 49 days - compare using differences of u32_t rather than magnitude
 u32_t gettime_ms(void) {
+	return (u32_t)(gettime_us() / 1000);
+}
+
+// monotonic microseconds which do not wrap, the base of gettime_ms
+u64_t gettime_us(void) {
 #if WIN
-	return GetTickCount();
+	return GetTickCount64() * 1000;
 #else
 #if LINUX
 	struct timespec ts;
 	if (!clock_gettime(CLOCK_MONOTONIC, &ts)) {
-		return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+		return (u64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 	}
 #endif
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	return (u64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 #endif
 }
 
+// copy a snapshot, retrying if the writer published while it was being copied
+void snapshot_read(void *dst, const void *src, size_t size) {
+	const volatile unsigned *seq = src;
+	unsigned s;
+
+	do {
+		while ((s = *seq) & 1);
+		memory_barrier();
+		memcpy(dst, src, size);
+		memory_barrier();
+	} while (*seq != s);
+}
+
+// ms since the first call, which main makes as it starts, for the startup timeline
+u32_t startup_ms(void) {
+	static u32_t start;
+	if (!start) {
+		start = gettime_ms();
+	}
+	return gettime_ms() - start;
+}
+
 // mac address
 #if LINUX
 // search first 4 interfaces returned by IFCONF
@@ -182,11 +210,16 @@ in_addr_t server_addr(const char *server) {
 	return ip;
 }
 
+#if WINEVENT
+static sockfd readwake_sock; // the event of a socket does not tell reads from writes, its network events do
+#endif
+
 void set_readwake_handles(event_handle handles[], sockfd s, event_event e) {
 #if WINEVENT
+	readwake_sock = s;
 	handles[0] = WSACreateEvent();
 	handles[1] = e;
-	WSAEventSelect(s, handles[0], FD_READ | FD_CLOSE);
+	WSAEventSelect(s, handles[0], FD_READ | FD_CLOSE | FD_WRITE);
 #elif SELFPIPE
 	handles[0].fd = s;
 	handles[1].fd = e.fds[0];
@@ -204,8 +237,12 @@ event_type wait_readwake(event_handle handles[], int timeout) {
 #if WINEVENT
 	int wait = WSAWaitForMultipleEvents(2, handles, FALSE, timeout, FALSE);
 	if (wait == WSA_WAIT_EVENT_0) {
-		WSAResetEvent(handles[0]);
-		return EVENT_READ;
+		WSANETWORKEVENTS events;
+		// also resets the event
+		if (WSAEnumNetworkEvents(readwake_sock, handles[0], &events) != 0 || (events.lNetworkEvents & (FD_READ | FD_CLOSE))) {
+			return EVENT_READ;
+		}
+		return EVENT_WRITE;
 	} else if (wait == WSA_WAIT_EVENT_0 + 1) {
 		return EVENT_WAKE;
 	} else {
@@ -213,13 +250,16 @@ event_type wait_readwake(event_handle handles[], int timeout) {
 	}
 #else
 	if (poll(handles, 2, timeout) > 0) {
-		if (handles[0].revents) {
+		if (handles[0].revents & ~POLLOUT) {
 			return EVENT_READ;
 		}
 		if (handles[1].revents) {
 			wake_clear(handles[1].fd);
 			return EVENT_WAKE;
 		}
+		if (handles[0].revents) {
+			return EVENT_WRITE;
+		}
 	}
 	return EVENT_TIMEOUT;
 #endif
@@ -315,6 +355,25 @@ int poll(struct pollfd *fds, unsigned long numfds, int timeout) {
 	return ret;
 }
 
+ssize_t writev(sockfd s, const struct iovec *iov, int iovcnt) {
+	WSABUF bufs[16];
+	DWORD sent;
+	int i;
+
+	if (iovcnt > 16) iovcnt = 16;
+
+	for (i = 0; i < iovcnt; ++i) {
+		bufs[i].buf = iov[i].iov_base;
+		bufs[i].len = (ULONG)iov[i].iov_len;
+	}
+
+	if (WSASend(s, bufs, iovcnt, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+		return -1;
+	}
+
+	return sent;
+}
+
 #endif
 
 #if LINUX
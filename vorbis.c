@@ -112,8 +112,12 @@ static decode_state vorbis_decode(void) {
 		info = v->ov_info(v->vf, -1);
 
 		LOG_INFO("setting track_start");
-		output.next_sample_rate = info->rate; 
-		output.track_start = outputbuf->writep;
+		output.next_sample_rate = _decode_newstream(info->rate);
+		if (!_output_track_start()) {
+			UNLOCK_O;
+			UNLOCK_S;
+			return DECODE_ERROR;
+		}
 		if (output.fade_mode) _checkfade(true);
 		decode.new_stream = false;
 
@@ -125,6 +129,9 @@ static decode_state vorbis_decode(void) {
 			UNLOCK_S;
 			return DECODE_ERROR;
 		}
+
+		// recalculate as a crossfade may have moved writep
+		frames = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
 	}
 
 	bytes = frames * 2 * channels; // samples returned are 16 bits
@@ -164,7 +171,7 @@ static decode_state vorbis_decode(void) {
 			}
 		}
 
-		_buf_inc_writep(outputbuf, frames * BYTES_PER_FRAME);
+		_decode_inc_writep(frames * BYTES_PER_FRAME);
 
 		LOG_SDEBUG("wrote %u frames", frames);
 